@@ -24,7 +24,9 @@ enum class OFSErrorCodes : int32_t {
     ERROR_NOT_IMPLEMENTED = -8,
     ERROR_INVALID_SESSION = -9,
     ERROR_DIRECTORY_NOT_EMPTY = -10,
-    ERROR_INVALID_OPERATION = -11
+    ERROR_INVALID_OPERATION = -11,
+    ERROR_SERVER_BUSY = -12,
+    ERROR_TIMEOUT = -13
 };
 
 enum class EntryType : uint8_t {
@@ -69,7 +71,11 @@ struct OMNIHeader {
     uint8_t require_auth;
     uint32_t admin_index;  // Admin's random index
     
-    uint8_t reserved[291];  // Adjusted to maintain 512 bytes total
+    uint64_t user_quota;   // Max bytes a user's files and /users/<name> may hold, 0 = unlimited
+    uint8_t dedup;         // Store identical content blocks once
+    uint8_t compression;   // Compress new files unless a directory says otherwise
+    
+    uint8_t reserved[281];  // Adjusted to keep the header size unchanged
 
     OMNIHeader() = default;
     
@@ -84,6 +90,9 @@ struct OMNIHeader {
         memset(reserved, 0, sizeof(reserved));
         require_auth = 1;
         admin_index = 0;
+        user_quota = 0;
+        dedup = 0;
+        compression = 0;
     }
 };
 
@@ -118,14 +127,15 @@ struct FileEntry {
     uint64_t modified_time;
     char owner[32];
     uint32_t inode;
-    uint8_t reserved[47];
+    uint32_t generation;   // Must match for by-inode lookups
+    uint8_t reserved[43];
 
     FileEntry() = default;
     
     FileEntry(const string& filename, EntryType entry_type, uint64_t file_size, 
               uint32_t perms, const string& file_owner, uint32_t file_inode)
         : type(static_cast<uint8_t>(entry_type)), size(file_size), permissions(perms), 
-          created_time(0), modified_time(0), inode(file_inode) {
+          created_time(0), modified_time(0), inode(file_inode), generation(0) {
         strncpy(name, filename.c_str(), sizeof(name) - 1);
         name[sizeof(name) - 1] = '\0';
         strncpy(owner, file_owner.c_str(), sizeof(owner) - 1);
@@ -181,14 +191,37 @@ struct FSStats {
     uint32_t total_users;
     uint32_t active_sessions;
     double fragmentation;
-    uint8_t reserved[64];
+    double dedup_ratio;            // blocks held by files per block stored
+    uint64_t dedup_index_entries;
+    uint64_t dedup_index_bytes;
+    double compression_ratio;      // of all chunks stored compressed since startup
+    double compress_mb_per_sec;
+    double decompress_mb_per_sec;
+    uint8_t reserved[16];
 
     FSStats() = default;
     
     FSStats(uint64_t total, uint64_t used, uint64_t free)
         : total_size(total), used_space(used), free_space(free),
           total_files(0), total_directories(0), total_users(0),
-          active_sessions(0), fragmentation(0.0) {
+          active_sessions(0), fragmentation(0.0), dedup_ratio(1.0),
+          dedup_index_entries(0), dedup_index_bytes(0), compression_ratio(1.0),
+          compress_mb_per_sec(0.0), decompress_mb_per_sec(0.0) {
+        memset(reserved, 0, sizeof(reserved));
+    }
+};
+
+struct DirUsage {
+    uint64_t total_bytes;
+    uint64_t total_blocks;
+    uint32_t total_files;
+    uint32_t total_directories;
+    uint8_t reserved[40];
+
+    DirUsage() = default;
+    
+    DirUsage(uint64_t bytes, uint64_t blocks, uint32_t files, uint32_t dirs)
+        : total_bytes(bytes), total_blocks(blocks), total_files(files), total_directories(dirs) {
         memset(reserved, 0, sizeof(reserved));
     }
 };
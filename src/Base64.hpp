@@ -0,0 +1,285 @@
+#ifndef BASE64_HPP
+#define BASE64_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BASE64_X86 1
+#endif
+
+using namespace std;
+
+// Standard base64 (RFC 4648, '+' '/' and '=' padding). The scalar codec is
+// the reference; on x86 the bulk of the input goes through SSSE3 or AVX2
+// kernels picked once at runtime, and the scalar code handles what is left
+// at the end (including padding). The vector decoders stop at the first
+// character outside the alphabet and leave it to the scalar path to reject.
+//
+// Kernels after W. Muła and D. Lemire, "Faster Base64 Encoding and Decoding
+// using AVX2 Instructions" (2018).
+
+namespace base64_detail {
+
+static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+inline int8_t value_of(unsigned char c) {
+    if (c >= 'A' && c <= 'Z') return static_cast<int8_t>(c - 'A');
+    if (c >= 'a' && c <= 'z') return static_cast<int8_t>(c - 'a' + 26);
+    if (c >= '0' && c <= '9') return static_cast<int8_t>(c - '0' + 52);
+    if (c == '+') return 62;
+    if (c == '/') return 63;
+    return -1;
+}
+
+// Encodes whole and partial groups from in[0..n) into out
+inline void encode_scalar(const uint8_t* in, size_t n, char* out) {
+    size_t i = 0;
+    for (; i + 3 <= n; i += 3) {
+        uint32_t v = (in[i] << 16) | (in[i + 1] << 8) | in[i + 2];
+        *out++ = alphabet[(v >> 18) & 63];
+        *out++ = alphabet[(v >> 12) & 63];
+        *out++ = alphabet[(v >> 6) & 63];
+        *out++ = alphabet[v & 63];
+    }
+    if (i < n) {
+        uint32_t v = in[i] << 16;
+        if (i + 1 < n) v |= in[i + 1] << 8;
+        *out++ = alphabet[(v >> 18) & 63];
+        *out++ = alphabet[(v >> 12) & 63];
+        *out++ = i + 1 < n ? alphabet[(v >> 6) & 63] : '=';
+        *out++ = '=';
+    }
+}
+
+// Decodes in[0..n); padding is optional but only allowed at the very end
+inline bool decode_scalar(const char* in, size_t n, uint8_t* out, size_t& written) {
+    while (n > 0 && in[n - 1] == '=') n--;
+    if (n % 4 == 1) return false;
+    written = 0;
+    uint32_t v = 0;
+    int bits = 0;
+    for (size_t i = 0; i < n; i++) {
+        int8_t d = value_of(static_cast<unsigned char>(in[i]));
+        if (d < 0) return false;
+        v = (v << 6) | static_cast<uint32_t>(d);
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            out[written++] = static_cast<uint8_t>(v >> bits);
+        }
+    }
+    return true;
+}
+
+#ifdef BASE64_X86
+
+// 12 input bytes -> 16 six-bit values, one per byte
+__attribute__((target("ssse3,sse4.1"))) inline __m128i enc_reshuffle_128(__m128i in) {
+    in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+    __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+    __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+    __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+    __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+    return _mm_or_si128(t1, t3);
+}
+
+// Six-bit values -> ASCII, by adding a per-range offset
+__attribute__((target("ssse3,sse4.1"))) inline __m128i enc_translate_128(__m128i in) {
+    const __m128i lut = _mm_setr_epi8(65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0);
+    __m128i indices = _mm_subs_epu8(in, _mm_set1_epi8(51));
+    __m128i mask = _mm_cmpgt_epi8(in, _mm_set1_epi8(25));
+    indices = _mm_sub_epi8(indices, mask);
+    return _mm_add_epi8(in, _mm_shuffle_epi8(lut, indices));
+}
+
+__attribute__((target("ssse3,sse4.1"))) inline void encode_ssse3(const uint8_t* in, size_t n, char* out) {
+    // Each step loads 16 bytes and uses 12
+    while (n >= 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), enc_translate_128(enc_reshuffle_128(v)));
+        in += 12;
+        out += 16;
+        n -= 12;
+    }
+    encode_scalar(in, n, out);
+}
+
+__attribute__((target("avx2"))) inline __m256i enc_reshuffle_256(__m256i in) {
+    in = _mm256_shuffle_epi8(in, _mm256_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+                                                 14, 15, 13, 14, 11, 12, 10, 11, 8, 9, 7, 8, 5, 6, 4, 5));
+    __m256i t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00));
+    __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+    __m256i t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0));
+    __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+    return _mm256_or_si256(t1, t3);
+}
+
+__attribute__((target("avx2"))) inline __m256i enc_translate_256(__m256i in) {
+    const __m256i lut = _mm256_setr_epi8(65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0,
+                                         65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0);
+    __m256i indices = _mm256_subs_epu8(in, _mm256_set1_epi8(51));
+    __m256i mask = _mm256_cmpgt_epi8(in, _mm256_set1_epi8(25));
+    indices = _mm256_sub_epi8(indices, mask);
+    return _mm256_add_epi8(in, _mm256_shuffle_epi8(lut, indices));
+}
+
+__attribute__((target("avx2"))) inline void encode_avx2(const uint8_t* in, size_t n, char* out) {
+    // The 256-bit load starts 4 bytes before the 24 it uses, so the first
+    // group goes through the scalar code to make room behind the pointer
+    if (n >= 32) {
+        encode_scalar(in, 6, out);
+        in += 6;
+        out += 8;
+        n -= 6;
+        while (n >= 28) {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in - 4));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), enc_translate_256(enc_reshuffle_256(v)));
+            in += 24;
+            out += 32;
+            n -= 24;
+        }
+    }
+    encode_scalar(in, n, out);
+}
+
+// Validates 16 characters and maps them to six-bit values; false if any is
+// outside the alphabet (padding included)
+__attribute__((target("ssse3,sse4.1"))) inline bool dec_translate_128(__m128i& str) {
+    const __m128i lut_lo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                         0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m128i lut_hi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                         0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m128i lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i mask_2f = _mm_set1_epi8(0x2f);
+
+    __m128i hi_nibbles = _mm_and_si128(_mm_srli_epi32(str, 4), mask_2f);
+    __m128i lo_nibbles = _mm_and_si128(str, mask_2f);
+    __m128i hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+    __m128i lo = _mm_shuffle_epi8(lut_lo, lo_nibbles);
+    if (!_mm_testz_si128(lo, hi)) return false;
+
+    __m128i eq_2f = _mm_cmpeq_epi8(str, mask_2f);
+    __m128i roll = _mm_shuffle_epi8(lut_roll, _mm_add_epi8(eq_2f, hi_nibbles));
+    str = _mm_add_epi8(str, roll);
+    return true;
+}
+
+// 16 six-bit values -> 12 bytes in the low lanes
+__attribute__((target("ssse3,sse4.1"))) inline __m128i dec_reshuffle_128(__m128i in) {
+    __m128i merged = _mm_maddubs_epi16(in, _mm_set1_epi32(0x01400140));
+    __m128i out = _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000));
+    return _mm_shuffle_epi8(out, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+}
+
+__attribute__((target("ssse3,sse4.1"))) inline bool decode_ssse3(const char* in, size_t n, uint8_t* out, size_t& written) {
+    uint8_t* start = out;
+    // Stores write 16 bytes of which 12 are kept; the tail is always at
+    // least one padded group, so the extra 4 land inside the output
+    while (n >= 24) {
+        __m128i str = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in));
+        if (!dec_translate_128(str)) break;
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), dec_reshuffle_128(str));
+        in += 16;
+        out += 12;
+        n -= 16;
+    }
+    size_t rest = 0;
+    if (!decode_scalar(in, n, out, rest)) return false;
+    written = static_cast<size_t>(out - start) + rest;
+    return true;
+}
+
+__attribute__((target("avx2"))) inline bool decode_avx2(const char* in, size_t n, uint8_t* out, size_t& written) {
+    const __m256i lut_lo = _mm256_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                            0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A,
+                                            0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                            0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m256i lut_hi = _mm256_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                            0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+                                            0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                            0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m256i lut_roll = _mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+                                              0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i mask_2f = _mm256_set1_epi8(0x2f);
+
+    uint8_t* start = out;
+    // 32 characters -> 24 bytes, stored as 32; see decode_ssse3
+    while (n >= 45) {
+        __m256i str = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in));
+        __m256i hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(str, 4), mask_2f);
+        __m256i lo_nibbles = _mm256_and_si256(str, mask_2f);
+        __m256i hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+        __m256i lo = _mm256_shuffle_epi8(lut_lo, lo_nibbles);
+        if (!_mm256_testz_si256(lo, hi)) break;
+
+        __m256i eq_2f = _mm256_cmpeq_epi8(str, mask_2f);
+        __m256i roll = _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(eq_2f, hi_nibbles));
+        str = _mm256_add_epi8(str, roll);
+
+        __m256i merged = _mm256_maddubs_epi16(str, _mm256_set1_epi32(0x01400140));
+        __m256i v = _mm256_madd_epi16(merged, _mm256_set1_epi32(0x00011000));
+        v = _mm256_shuffle_epi8(v, _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                                                    2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+        v = _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, -1, -1));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), v);
+        in += 32;
+        out += 24;
+        n -= 32;
+    }
+    size_t rest = 0;
+    if (!decode_ssse3(in, n, out, rest)) return false;
+    written = static_cast<size_t>(out - start) + rest;
+    return true;
+}
+
+#endif
+
+struct Codec {
+    const char* name;
+    void (*encode)(const uint8_t*, size_t, char*);
+    bool (*decode)(const char*, size_t, uint8_t*, size_t&);
+};
+
+inline const Codec& codec() {
+    static const Codec selected = []() {
+#ifdef BASE64_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) return Codec{"avx2", encode_avx2, decode_avx2};
+        if (__builtin_cpu_supports("ssse3") && __builtin_cpu_supports("sse4.1")) {
+            return Codec{"ssse3", encode_ssse3, decode_ssse3};
+        }
+#endif
+        return Codec{"scalar", encode_scalar, decode_scalar};
+    }();
+    return selected;
+}
+
+}
+
+inline size_t base64_encoded_size(size_t n) {
+    return (n + 2) / 3 * 4;
+}
+
+// Upper bound for the decoder's output buffer
+inline size_t base64_decoded_capacity(size_t n) {
+    return n / 4 * 3 + 3;
+}
+
+// out must hold base64_encoded_size(n) characters
+inline void base64_encode(const char* in, size_t n, char* out) {
+    base64_detail::codec().encode(reinterpret_cast<const uint8_t*>(in), n, out);
+}
+
+// out must hold base64_decoded_capacity(n) bytes; false on malformed input
+inline bool base64_decode(const char* in, size_t n, char* out, size_t& written) {
+    return base64_detail::codec().decode(in, n, reinterpret_cast<uint8_t*>(out), written);
+}
+
+inline const char* base64_codec_name() {
+    return base64_detail::codec().name;
+}
+
+#endif
@@ -0,0 +1,111 @@
+#ifndef BINARY_PROTOCOL_HPP
+#define BINARY_PROTOCOL_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+using namespace std;
+
+// Compact alternative to the JSON protocol, chosen per connection: a request
+// whose first four bytes are BINARY_MAGIC is a binary frame, anything else is
+// JSON. Integers are little-endian and headers are packed.
+//
+// Request:  BinaryRequestHeader | session id | field*
+//   field:  id u8 | type u8 | length u32 | value
+// Response: BinaryResponseHeader | data | payload
+//
+// Fields are the JSON parameters under numeric ids; file content travels as
+// raw bytes, never escaped. Response data is the handler's JSON metadata (or
+// the error message on failure) and payload is file content, if any.
+// Opcodes and field ids are append-only; unknown field ids are skipped.
+
+const uint32_t BINARY_MAGIC = 0x4253464f;  // "OFSB"
+const uint8_t BINARY_VERSION = 1;
+
+#pragma pack(push, 1)
+struct BinaryRequestHeader {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t opcode;
+    uint16_t session_length;
+    uint32_t request_id;
+    uint32_t body_length;  // session id and fields
+};
+
+struct BinaryResponseHeader {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t opcode;
+    uint16_t reserved;
+    uint32_t request_id;
+    int32_t status;           // OFSErrorCodes
+    uint32_t data_length;
+    uint32_t payload_length;
+};
+#pragma pack(pop)
+
+enum BinaryFieldType : uint8_t {
+    FIELD_STRING = 1,
+    FIELD_INT = 2,    // 8-byte signed
+    FIELD_BYTES = 3
+};
+
+static const char* const binary_operations[] = {
+    "", "init", "login", "logout", "user_create", "user_delete", "user_list",
+    "file_create", "file_read", "file_read_by_inode", "stat_by_inode", "file_delete",
+    "file_rename", "move", "dir_create", "dir_list", "dir_delete", "dir_delete_recursive",
+    "dir_usage", "get_stats", "server_stats", "get_user_usage", "file_edit",
+    "batch", "file_append", "file_truncate", "file_copy", "file_read_range", "dir_set_compression"
+};
+
+static const char* const binary_fields[] = {
+    "", "path", "data", "inode", "old_path", "new_path", "config_path", "omni_path",
+    "username", "password", "role", "user_index", "prefix", "start_after", "type", "limit",
+    "index", "encoding", "operations", "atomic", "length", "offset", "compression", "generation"
+};
+
+inline const char* binary_operation_name(uint8_t opcode) {
+    return opcode < sizeof(binary_operations) / sizeof(binary_operations[0]) ? binary_operations[opcode] : "";
+}
+
+inline const char* binary_field_name(uint8_t id) {
+    return id > 0 && id < sizeof(binary_fields) / sizeof(binary_fields[0]) ? binary_fields[id] : nullptr;
+}
+
+inline bool is_binary_request(const string& data) {
+    uint32_t magic;
+    if (data.size() < sizeof(magic)) return false;
+    memcpy(&magic, data.data(), sizeof(magic));
+    return magic == BINARY_MAGIC;
+}
+
+// Size of the whole frame once its header has arrived, else 0
+inline size_t binary_frame_length(const string& data) {
+    BinaryRequestHeader header;
+    if (data.size() < sizeof(header)) return 0;
+    memcpy(&header, data.data(), sizeof(header));
+    return sizeof(header) + header.body_length;
+}
+
+inline string encode_binary_response(uint8_t opcode, uint32_t request_id, int32_t status,
+                                     const string& data, const string& payload) {
+    BinaryResponseHeader header;
+    header.magic = BINARY_MAGIC;
+    header.version = BINARY_VERSION;
+    header.opcode = opcode;
+    header.reserved = 0;
+    header.request_id = request_id;
+    header.status = status;
+    header.data_length = static_cast<uint32_t>(data.size());
+    header.payload_length = static_cast<uint32_t>(payload.size());
+
+    string out;
+    out.reserve(sizeof(header) + data.size() + payload.size());
+    out.append(reinterpret_cast<const char*>(&header), sizeof(header));
+    out += data;
+    out += payload;
+    return out;
+}
+
+#endif
@@ -1,107 +1,212 @@
 #ifndef BOUNDED_BLOCKING_QUEUE_HPP
 #define BOUNDED_BLOCKING_QUEUE_HPP
 
-#include <pthread.h>
-#include <iostream>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <utility>
+#include <climits>
+#include <vector>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
+inline void futex_wait(std::atomic<uint32_t>* word, uint32_t expected) {
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+}
+
+inline void futex_wake(std::atomic<uint32_t>* word, int count) {
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+}
+
+// Bounded MPMC ring (Vyukov): every cell carries a sequence number that says
+// whether it is ready to be written or read at a given position, so producers
+// and consumers only race on their own position counter with one CAS each.
+// Blocking calls park on a futex instead of spinning when the ring is empty
+// or full. Elements are moved in and out, so T only needs to be movable and
+// default-constructible. The ring holds at least two cells; with one, "full
+// at pos" and "free at pos + 1" would carry the same sequence number.
 template<typename T>
 class BoundedBlockingQueue {
 private:
-    T* buffer;
-    int capacity;
-    int size;
-    int front;
-    int rear;
-    
-    pthread_mutex_t mutex;
-    pthread_cond_t not_empty;
-    pthread_cond_t not_full;
-    
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T data;
+    };
+
+    Cell* buffer;
+    size_t capacity;
+
+    alignas(64) std::atomic<size_t> enqueue_pos;
+    alignas(64) std::atomic<size_t> dequeue_pos;
+
+    // Futex words: bumped after every enqueue / dequeue so a parked thread
+    // wakes (or refuses to sleep) once the ring has changed under it
+    alignas(64) std::atomic<uint32_t> items_seq;
+    std::atomic<uint32_t> waiting_consumers;
+    alignas(64) std::atomic<uint32_t> slots_seq;
+    std::atomic<uint32_t> waiting_producers;
+
+    void item_added() {
+        items_seq.fetch_add(1);
+        if (waiting_consumers.load() > 0) futex_wake(&items_seq, 1);
+    }
+
+    void slot_freed(int count = 1) {
+        slots_seq.fetch_add(1);
+        if (waiting_producers.load() > 0) futex_wake(&slots_seq, count);
+    }
+
+    template<typename U>
+    bool push(U&& item) {
+        size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+        Cell* cell;
+        for (;;) {
+            cell = &buffer[pos % capacity];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+        cell->data = std::forward<U>(item);
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& item) {
+        size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+        Cell* cell;
+        for (;;) {
+            cell = &buffer[pos % capacity];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+            if (diff == 0) {
+                if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = dequeue_pos.load(std::memory_order_relaxed);
+            }
+        }
+        item = std::move(cell->data);
+        cell->data = T();
+        cell->sequence.store(pos + capacity, std::memory_order_release);
+        return true;
+    }
+
+    T dequeue_one_parked() {
+        T item;
+        for (;;) {
+            uint32_t seen = items_seq.load();
+            if (pop(item)) break;
+            waiting_consumers.fetch_add(1);
+            futex_wait(&items_seq, seen);
+            waiting_consumers.fetch_sub(1);
+        }
+        return item;
+    }
+
+    template<typename U>
+    void enqueue_blocking(U&& item) {
+        for (;;) {
+            uint32_t seen = slots_seq.load();
+            if (push(std::forward<U>(item))) break;
+            waiting_producers.fetch_add(1);
+            futex_wait(&slots_seq, seen);
+            waiting_producers.fetch_sub(1);
+        }
+        item_added();
+    }
+
 public:
-    BoundedBlockingQueue(int cap) : capacity(cap), size(0), front(0), rear(0) {
-        buffer = new T[capacity];
-        pthread_mutex_init(&mutex, nullptr);
-        pthread_cond_init(&not_empty, nullptr);
-        pthread_cond_init(&not_full, nullptr);
+    BoundedBlockingQueue(int cap)
+        : capacity(cap > 2 ? cap : 2), enqueue_pos(0), dequeue_pos(0),
+          items_seq(0), waiting_consumers(0), slots_seq(0), waiting_producers(0) {
+        buffer = new Cell[capacity];
+        for (size_t i = 0; i < capacity; i++) {
+            buffer[i].sequence.store(i, std::memory_order_relaxed);
+        }
     }
-    
+
     ~BoundedBlockingQueue() {
         delete[] buffer;
-        pthread_mutex_destroy(&mutex);
-        pthread_cond_destroy(&not_empty);
-        pthread_cond_destroy(&not_full);
     }
-    
+
+    BoundedBlockingQueue(const BoundedBlockingQueue&) = delete;
+    BoundedBlockingQueue& operator=(const BoundedBlockingQueue&) = delete;
+
     void enqueue(const T& item) {
-        pthread_mutex_lock(&mutex);
-        
-        while (size == capacity) {
-            pthread_cond_wait(&not_full, &mutex);
-        }
-        
-        buffer[rear] = item;
-        rear = (rear + 1) % capacity;
-        size++;
-        
-        pthread_cond_signal(&not_empty);
-        pthread_mutex_unlock(&mutex);
+        enqueue_blocking(item);
     }
-    
+
+    void enqueue(T&& item) {
+        enqueue_blocking(std::move(item));
+    }
+
+    bool try_enqueue(T&& item) {
+        if (!push(std::move(item))) return false;
+        item_added();
+        return true;
+    }
+
     T dequeue() {
-        pthread_mutex_lock(&mutex);
-        
-        while (size == 0) {
-            pthread_cond_wait(&not_empty, &mutex);
-        }
-        
-        T item = buffer[front];
-        front = (front + 1) % capacity;
-        size--;
-        
-        pthread_cond_signal(&not_full);
-        pthread_mutex_unlock(&mutex);
-        
+        T item = dequeue_one_parked();
+        slot_freed();
         return item;
     }
-    
-    bool try_dequeue(T& item) {
-        pthread_mutex_lock(&mutex);
+
+    // Blocks until at least one element is available, then takes whatever
+    // else is already queued, up to max_n, with a single producer wake-up
+    std::vector<T> dequeue_bulk(size_t max_n) {
+        std::vector<T> items;
+        if (max_n == 0) return items;
+        items.push_back(dequeue_one_parked());
         
-        if (size == 0) {
-            pthread_mutex_unlock(&mutex);
-            return false;
+        T item;
+        while (items.size() < max_n && pop(item)) {
+            items.push_back(std::move(item));
         }
-        
-        item = buffer[front];
-        front = (front + 1) % capacity;
-        size--;
-        
-        pthread_cond_signal(&not_full);
-        pthread_mutex_unlock(&mutex);
-        
+        slot_freed(static_cast<int>(items.size()));
+        return items;
+    }
+
+    // Non-blocking: appends up to max_n queued elements to out, returns how many
+    size_t try_dequeue_bulk(std::vector<T>& out, size_t max_n) {
+        size_t taken = 0;
+        T item;
+        while (taken < max_n && pop(item)) {
+            out.push_back(std::move(item));
+            taken++;
+        }
+        if (taken > 0) slot_freed(static_cast<int>(taken));
+        return taken;
+    }
+
+    bool try_dequeue(T& item) {
+        if (!pop(item)) return false;
+        slot_freed();
         return true;
     }
-    
+
+    // Approximate under concurrency, exact when the queue is quiescent
     int get_size() {
-        pthread_mutex_lock(&mutex);
-        int current_size = size;
-        pthread_mutex_unlock(&mutex);
-        return current_size;
+        size_t head = dequeue_pos.load();
+        size_t tail = enqueue_pos.load();
+        return tail > head ? static_cast<int>(tail - head) : 0;
     }
-    
+
     bool is_empty() {
-        pthread_mutex_lock(&mutex);
-        bool empty = (size == 0);
-        pthread_mutex_unlock(&mutex);
-        return empty;
+        return get_size() == 0;
     }
-    
+
     bool is_full() {
-        pthread_mutex_lock(&mutex);
-        bool full = (size == capacity);
-        pthread_mutex_unlock(&mutex);
-        return full;
+        return get_size() >= static_cast<int>(capacity);
     }
 };
 
-#endif
\ No newline at end of file
+#endif
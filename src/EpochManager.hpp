@@ -0,0 +1,129 @@
+#ifndef EPOCH_HPP
+#define EPOCH_HPP
+
+#include <atomic>
+#include <vector>
+#include <cstdint>
+#include <pthread.h>
+
+using namespace std;
+
+#define MAX_EPOCH_THREADS 128
+#define RECLAIM_INTERVAL 64
+
+// Epoch-based reclamation for structures that readers walk without locks.
+// A reader announces the current epoch while it holds pointers; a writer that
+// unlinks something retires it instead of deleting it, and it is freed once
+// every announced epoch has moved past the one it was retired in.
+class EpochManager {
+private:
+    struct alignas(64) Slot {
+        atomic<uint64_t> epoch;  // 0 = not inside a read section
+        atomic<bool> used;
+    };
+
+    struct Retired {
+        void* ptr;
+        void (*deleter)(void*);
+        uint64_t epoch;
+    };
+
+    struct SlotHandle {
+        int index;
+        int depth;
+        SlotHandle() : index(-1), depth(0) {}
+        ~SlotHandle() {
+            if (index >= 0) slots[index].used.store(false);
+        }
+    };
+
+    static atomic<uint64_t> global_epoch;
+    static atomic<uint32_t> overflow_readers;  // readers that found no free slot
+    static Slot slots[MAX_EPOCH_THREADS];
+    static pthread_mutex_t retire_lock;
+    static vector<Retired> retired;
+    static thread_local SlotHandle handle;
+
+    static int claim_slot() {
+        for (int i = 0; i < MAX_EPOCH_THREADS; i++) {
+            bool expected = false;
+            if (slots[i].used.compare_exchange_strong(expected, true)) return i;
+        }
+        return -1;
+    }
+
+    // Oldest epoch a reader may still be in; caller holds retire_lock
+    static uint64_t oldest_active() {
+        if (overflow_readers.load() > 0) return 0;
+        uint64_t oldest = global_epoch.load();
+        for (int i = 0; i < MAX_EPOCH_THREADS; i++) {
+            uint64_t e = slots[i].epoch.load();
+            if (e != 0 && e < oldest) oldest = e;
+        }
+        return oldest;
+    }
+
+public:
+    static void enter() {
+        if (handle.depth++ > 0) return;
+        if (handle.index < 0) handle.index = claim_slot();
+        if (handle.index < 0) {
+            // More threads than slots: hold back reclamation entirely instead
+            overflow_readers.fetch_add(1);
+        } else {
+            slots[handle.index].epoch.store(global_epoch.load());
+        }
+        atomic_thread_fence(memory_order_seq_cst);
+    }
+
+    static void exit() {
+        if (--handle.depth > 0) return;
+        if (handle.index < 0) {
+            overflow_readers.fetch_sub(1, memory_order_release);
+            return;
+        }
+        slots[handle.index].epoch.store(0, memory_order_release);
+    }
+
+    template <typename T>
+    static void retire(T* ptr) {
+        if (!ptr) return;
+        pthread_mutex_lock(&retire_lock);
+        retired.push_back({ptr, [](void* p) { delete static_cast<T*>(p); }, global_epoch.load()});
+        bool due = retired.size() % RECLAIM_INTERVAL == 0;
+        pthread_mutex_unlock(&retire_lock);
+        if (due) reclaim();
+    }
+
+    // Advances the epoch and frees whatever no reader can still reach
+    static void reclaim() {
+        global_epoch.fetch_add(1);
+
+        vector<Retired> ready;
+        pthread_mutex_lock(&retire_lock);
+        uint64_t oldest = oldest_active();
+        size_t kept = 0;
+        for (auto& item : retired) {
+            if (item.epoch < oldest) ready.push_back(item);
+            else retired[kept++] = item;
+        }
+        retired.resize(kept);
+        pthread_mutex_unlock(&retire_lock);
+
+        for (auto& item : ready) item.deleter(item.ptr);
+    }
+
+    static size_t pending() {
+        pthread_mutex_lock(&retire_lock);
+        size_t count = retired.size();
+        pthread_mutex_unlock(&retire_lock);
+        return count;
+    }
+};
+
+struct EpochGuard {
+    EpochGuard() { EpochManager::enter(); }
+    ~EpochGuard() { EpochManager::exit(); }
+};
+
+#endif
@@ -17,18 +17,19 @@ struct AVLFSNode {
 struct NameMapNode {
     string name;
     uint32_t child_id;
+    FSNode* fs_node;
     int height;
     NameMapNode* left;
     NameMapNode* right;
     
-    NameMapNode(const string& n, uint32_t id)
-        : name(n), child_id(id), height(1), left(nullptr), right(nullptr) {}
+    NameMapNode(const string& n, uint32_t id, FSNode* node)
+        : name(n), child_id(id), fs_node(node), height(1), left(nullptr), right(nullptr) {}
 };
 
 class AVLFSTree {
 private:
     AVLFSNode* root;
-    NameMapNode* name_map_root;
+    atomic<NameMapNode*> name_map_root;
     
     int height(AVLFSNode* node) {
         return node ? node->height : 0;
@@ -180,109 +181,117 @@ private:
         }
     }
     
-    NameMapNode* rotate_right(NameMapNode* y) {
-        NameMapNode* x = y->left;
-        NameMapNode* T2 = x->right;
+    // The name index is copy-on-write: a published NameMapNode is never
+    // modified again. Writers (holding the directory's lock) copy the nodes on
+    // the path they change, publish a new root, and retire the replaced nodes
+    // through EpochManager, so readers can walk any version without locks.
+    NameMapNode* clone(NameMapNode* node, vector<NameMapNode*>& replaced) {
+        replaced.push_back(node);
+        return new NameMapNode(*node);
+    }
+    
+    // y is a private copy; the child promoted above it is copied here
+    NameMapNode* rotate_right(NameMapNode* y, vector<NameMapNode*>& replaced) {
+        NameMapNode* x = clone(y->left, replaced);
+        y->left = x->right;
         x->right = y;
-        y->left = T2;
         update_height(y);
         update_height(x);
         return x;
     }
     
-    NameMapNode* rotate_left(NameMapNode* x) {
-        NameMapNode* y = x->right;
-        NameMapNode* T2 = y->left;
+    NameMapNode* rotate_left(NameMapNode* x, vector<NameMapNode*>& replaced) {
+        NameMapNode* y = clone(x->right, replaced);
+        x->right = y->left;
         y->left = x;
-        x->right = T2;
         update_height(x);
         update_height(y);
         return y;
     }
     
-    NameMapNode* insert_name_helper(NameMapNode* node, const string& name, uint32_t child_id) {
-        if (!node) return new NameMapNode(name, child_id);
+    NameMapNode* insert_name_helper(NameMapNode* node, const string& name, uint32_t child_id, FSNode* fs_node,
+                                    vector<NameMapNode*>& replaced) {
+        if (!node) return new NameMapNode(name, child_id, fs_node);
+        if (name == node->name) return node;
         
-        if (name < node->name)
-            node->left = insert_name_helper(node->left, name, child_id);
-        else if (name > node->name)
-            node->right = insert_name_helper(node->right, name, child_id);
+        NameMapNode* copy = clone(node, replaced);
+        if (name < copy->name)
+            copy->left = insert_name_helper(copy->left, name, child_id, fs_node, replaced);
         else
-            return node;
-        
-        update_height(node);
-        int balance = balance_factor(node);
-        
-        if (balance > 1 && name < node->left->name)
-            return rotate_right(node);
-        if (balance < -1 && name > node->right->name)
-            return rotate_left(node);
-        if (balance > 1 && name > node->left->name) {
-            node->left = rotate_left(node->left);
-            return rotate_right(node);
-        }
-        if (balance < -1 && name < node->right->name) {
-            node->right = rotate_right(node->right);
-            return rotate_left(node);
-        }
+            copy->right = insert_name_helper(copy->right, name, child_id, fs_node, replaced);
         
-        return node;
+        update_height(copy);
+        return balance_name_tree(copy, replaced);
     }
     
     NameMapNode* find_by_name_helper(NameMapNode* node, const string& name) {
-        if (!node) return nullptr;
-        if (node->name == name) return node;
-        if (name < node->name) return find_by_name_helper(node->left, name);
-        return find_by_name_helper(node->right, name);
+        while (node) {
+            if (node->name == name) return node;
+            node = (name < node->name) ? node->left : node->right;
+        }
+        return nullptr;
     }
     
-    NameMapNode* remove_name_helper(NameMapNode* node, const string& name, bool& deleted) {
+    NameMapNode* remove_name_helper(NameMapNode* node, const string& name, bool& deleted,
+                                    vector<NameMapNode*>& replaced) {
         if (!node) {
             deleted = false;
             return nullptr;
         }
         
-        if (name < node->name) {
-            node->left = remove_name_helper(node->left, name, deleted);
-        } else if (name > node->name) {
-            node->right = remove_name_helper(node->right, name, deleted);
+        NameMapNode* copy;
+        if (name != node->name) {
+            bool go_left = name < node->name;
+            NameMapNode* child = remove_name_helper(go_left ? node->left : node->right, name, deleted, replaced);
+            if (!deleted) return node;
+            copy = clone(node, replaced);
+            (go_left ? copy->left : copy->right) = child;
         } else {
             deleted = true;
+            replaced.push_back(node);
             if (!node->left || !node->right) {
-                NameMapNode* temp = node->left ? node->left : node->right;
-                if (!temp) {
-                    delete node;
-                    return nullptr;
-                }
-                *node = *temp;
-                delete temp;
+                return node->left ? node->left : node->right;
             }
+            NameMapNode* successor = node->right;
+            while (successor->left) successor = successor->left;
+            
+            bool removed = false;
+            copy = new NameMapNode(successor->name, successor->child_id, successor->fs_node);
+            copy->left = node->left;
+            copy->right = remove_name_helper(node->right, successor->name, removed, replaced);
         }
         
-        if (!node) return node;
-        update_height(node);
-        return balance_name_tree(node);
+        update_height(copy);
+        return balance_name_tree(copy, replaced);
     }
     
-    NameMapNode* balance_name_tree(NameMapNode* node) {
+    // node is a private copy
+    NameMapNode* balance_name_tree(NameMapNode* node, vector<NameMapNode*>& replaced) {
         int balance = balance_factor(node);
         
-        if (balance > 1 && balance_factor(node->left) >= 0)
-            return rotate_right(node);
-        if (balance > 1 && balance_factor(node->left) < 0) {
-            node->left = rotate_left(node->left);
-            return rotate_right(node);
+        if (balance > 1) {
+            if (balance_factor(node->left) < 0) {
+                node->left = rotate_left(clone(node->left, replaced), replaced);
+            }
+            return rotate_right(node, replaced);
         }
-        if (balance < -1 && balance_factor(node->right) <= 0)
-            return rotate_left(node);
-        if (balance < -1 && balance_factor(node->right) > 0) {
-            node->right = rotate_right(node->right);
-            return rotate_left(node);
+        if (balance < -1) {
+            if (balance_factor(node->right) > 0) {
+                node->right = rotate_right(clone(node->right, replaced), replaced);
+            }
+            return rotate_left(node, replaced);
         }
         
         return node;
     }
     
+    void publish(NameMapNode* new_root, const vector<NameMapNode*>& replaced) {
+        name_map_root.store(new_root, memory_order_release);
+        for (auto* old : replaced) {
+            EpochManager::retire(old);
+        }
+    }
+    
     void delete_name_tree(NameMapNode* node) {
         if (!node) return;
         delete_name_tree(node->left);
@@ -295,12 +304,15 @@ public:
     
     ~AVLFSTree() {
         delete_id_tree(root);
-        delete_name_tree(name_map_root);
+        delete_name_tree(name_map_root.load());
     }
     
     void insert(uint32_t child_id, const string& name, FSNode* fs_node) {
         root = insert_helper(root, child_id, fs_node);
-        name_map_root = insert_name_helper(name_map_root, name, child_id);
+        vector<NameMapNode*> replaced;
+        NameMapNode* new_root = insert_name_helper(name_map_root.load(memory_order_relaxed), name, child_id,
+                                                   fs_node, replaced);
+        publish(new_root, replaced);
     }
 
     void inorder_collect(AVLFSNode* node, vector<FSNode*>& result) {
@@ -311,12 +323,10 @@ public:
     }
 
     
+    // Safe without the directory's lock while the caller is inside an epoch
     FSNode* find(const string& name) {
-        NameMapNode* name_node = find_by_name_helper(name_map_root, name);
-        if (!name_node) return nullptr;
-        
-        AVLFSNode* id_node = find_by_id_helper(root, name_node->child_id);
-        return id_node ? id_node->fs_node : nullptr;
+        NameMapNode* name_node = find_by_name_helper(name_map_root.load(memory_order_acquire), name);
+        return name_node ? name_node->fs_node : nullptr;
     }
     
     FSNode* find_by_id(uint32_t child_id) {
@@ -325,18 +335,28 @@ public:
     }
     
     bool remove(const string& name) {
-        NameMapNode* name_node = find_by_name_helper(name_map_root, name);
+        NameMapNode* name_node = find_by_name_helper(name_map_root.load(memory_order_relaxed), name);
         if (!name_node) return false;
         
         uint32_t child_id = name_node->child_id;
         
         bool deleted_id = false, deleted_name = false;
         root = remove_helper(root, child_id, deleted_id);
-        name_map_root = remove_name_helper(name_map_root, name, deleted_name);
+        vector<NameMapNode*> replaced;
+        NameMapNode* new_root = remove_name_helper(name_map_root.load(memory_order_relaxed), name,
+                                                   deleted_name, replaced);
+        publish(new_root, replaced);
         
         return deleted_id && deleted_name;
     }
     
+    // Walks the name index in sorted order from just after start_after, collecting
+    // up to limit children whose name starts with prefix. Only the visited range is
+    // touched, so a page costs O(log n + limit). Returns true if more matches remain.
+    // Reads one published version, so a page never mixes states of the directory.
+    bool collect_page(const string& start_after, const string& prefix, int type_filter,
+                      size_t limit, vector<FSNode*>& result);
+    
     vector<FSNode*> get_all_sorted() {
         vector<FSNode*> result;
         inorder_collect(root, result);
@@ -356,9 +376,18 @@ public:
     }
 };
 
+// Whether files created below a directory are stored compressed
+enum class CompressionPolicy : uint8_t { INHERIT, ON, OFF };
+
+// Layout of a file stored compressed, one entry per chunk of
+// COMPRESSION_CHUNK_BLOCKS blocks: how many bytes the chunk's compressed form
+// takes, or 0 when the chunk is stored as is
+struct ChunkMap {
+    vector<uint32_t> stored;
+};
+
 struct FSNode {
     string name;
-    string full_path;
     EntryType type;
     FSNode* parent;
     AVLFSTree children;
@@ -369,26 +398,60 @@ struct FSNode {
     uint64_t created_time;
     uint64_t modified_time;
     uint32_t inode;
+    uint32_t generation;  // of the inode slot, so a stale (inode, generation) handle misses
     uint32_t start_block;
     uint32_t num_blocks;
     uint32_t next_child_id;
+    CompressionPolicy compression;  // directories
+    ChunkMap* chunk_map;            // files stored compressed, else null
+    
+    // Totals for everything below a directory, kept current on every mutation.
+    // Atomic because ancestors are only held shared while they are updated.
+    atomic<uint64_t> subtree_bytes;
+    atomic<uint64_t> subtree_blocks;
+    atomic<uint32_t> subtree_files;
+    atomic<uint32_t> subtree_dirs;
+    
+    // Guards this node's attributes and, for a directory, its child index
+    pthread_rwlock_t lock;
+    bool linked;  // false once unlinked; by-inode lookups must check it
 
     FSNode(const string& n, EntryType t, FSNode* p = nullptr) 
         : name(n), type(t), parent(p), permissions(0755), size(0),
-          created_time(0), modified_time(0), inode(0), 
-          start_block(0), num_blocks(0), next_child_id(1) {
+          created_time(0), modified_time(0), inode(0), generation(0),
+          start_block(0), num_blocks(0), next_child_id(1),
+          compression(CompressionPolicy::INHERIT), chunk_map(nullptr),
+          subtree_bytes(0), subtree_blocks(0), subtree_files(0), subtree_dirs(0),
+          linked(false) {
+        pthread_rwlock_init(&lock, nullptr);
+    }
+    
+    ~FSNode() {
+        delete chunk_map;
+        pthread_rwlock_destroy(&lock);
+    }
+    
+    // Built from the parent chain rather than stored, so a move only has to
+    // relink the node instead of rewriting every path in the subtree.
+    string full_path() const {
+        if (!parent) return "/";
         
-        if (parent && parent->parent) {
-            full_path = parent->full_path + "/" + name;
-        } else if (parent) {
-            full_path = "/" + name;
-        } else {
-            full_path = "/";
+        vector<const string*> parts;
+        for (const FSNode* node = this; node->parent; node = node->parent) {
+            parts.push_back(&node->name);
         }
+        
+        string path;
+        for (auto it = parts.rbegin(); it != parts.rend(); ++it) {
+            path += "/" + **it;
+        }
+        return path;
     }
     
+    // Sequential per directory; a random offset here could collide and
+    // silently drop the child from the id index
     uint32_t generate_child_id() {
-        return (++next_child_id) + (rand() % 1000000);
+        return ++next_child_id;
     }
     
     void add_child(FSNode* child) {
@@ -417,18 +480,231 @@ struct FSNode {
     }
 };
 
+inline bool AVLFSTree::collect_page(const string& start_after, const string& prefix, int type_filter,
+                                    size_t limit, vector<FSNode*>& result) {
+    vector<NameMapNode*> stack;
+    NameMapNode* node = name_map_root.load(memory_order_acquire);
+    
+    while (node) {
+        if (node->name > start_after && node->name >= prefix) {
+            stack.push_back(node);
+            node = node->left;
+        } else {
+            node = node->right;
+        }
+    }
+    
+    while (!stack.empty()) {
+        NameMapNode* current = stack.back();
+        stack.pop_back();
+        
+        if (current->name.compare(0, prefix.size(), prefix) != 0) {
+            return false;
+        }
+        
+        if (type_filter < 0 || static_cast<int>(current->fs_node->type) == type_filter) {
+            if (limit > 0 && result.size() == limit) return true;
+            result.push_back(current->fs_node);
+        }
+        
+        for (NameMapNode* next = current->right; next; next = next->left) {
+            stack.push_back(next);
+        }
+    }
+    return false;
+}
+
+// Owns every FSNode. Slot i holds the node with inode i, which is also its
+// Entry Index in the Metadata Index Area (0 = no entry, 1 = root). A slot's
+// generation goes up every time it is reused, so a client holding on to an
+// (inode, generation) pair from an earlier dir_list cannot reach whatever
+// file took the slot after its own was deleted.
+// By-inode lookups hold `lock` shared until they drop the node's own lock,
+// so release() cannot recycle a slot somebody is still waiting on. The node
+// itself is freed through EpochManager, since lock-free path lookups may
+// still be looking at it.
+class InodeTable {
+private:
+    vector<FSNode*> slots;
+    vector<uint32_t> generations;
+    vector<uint32_t> free_slots;
+    atomic<uint32_t> live_count;
+
+public:
+    pthread_rwlock_t lock;
+
+    InodeTable() : live_count(0) {
+        slots.push_back(nullptr);
+        generations.push_back(0);
+        pthread_rwlock_init(&lock, nullptr);
+    }
+
+    ~InodeTable() {
+        for (auto* node : slots) {
+            delete node;
+        }
+        pthread_rwlock_destroy(&lock);
+    }
+
+    uint32_t allocate(FSNode* node) {
+        pthread_rwlock_wrlock(&lock);
+        uint32_t inode;
+        if (!free_slots.empty()) {
+            inode = free_slots.back();
+            free_slots.pop_back();
+            slots[inode] = node;
+            generations[inode]++;
+        } else {
+            inode = slots.size();
+            slots.push_back(node);
+            generations.push_back(1);
+        }
+        node->inode = inode;
+        node->generation = generations[inode];
+        live_count++;
+        pthread_rwlock_unlock(&lock);
+        return inode;
+    }
+
+    // Caller holds lock (shared is enough)
+    FSNode* get(uint32_t inode, uint32_t generation) {
+        if (inode == 0 || inode >= slots.size() || generations[inode] != generation) return nullptr;
+        return slots[inode];
+    }
+
+    void release(uint32_t inode) {
+        pthread_rwlock_wrlock(&lock);
+        if (inode != 0 && inode < slots.size() && slots[inode]) {
+            EpochManager::retire(slots[inode]);
+            slots[inode] = nullptr;
+            free_slots.push_back(inode);
+            live_count--;
+        }
+        pthread_rwlock_unlock(&lock);
+    }
+
+    uint32_t size() const { return live_count; }
+    uint32_t capacity() const { return slots.size() - 1; }
+};
+
+enum class LockMode { SHARED, EXCLUSIVE };
+
+// The locks one operation holds, released in reverse order when it ends.
+// It also pins the current epoch for the operation's whole lifetime.
+// Node locks are always taken top-down along the tree, so two operations can
+// never wait on each other in opposite order. Nodes unlinked while the locks
+// were held go back to the inode table only after every lock is dropped.
+class PathLocks {
+private:
+    EpochGuard epoch;  // keeps every node reached during the operation alive
+    vector<pthread_rwlock_t*> held;
+    vector<uint32_t> retired;
+    InodeTable* table;
+
+public:
+    PathLocks() : table(nullptr) {}
+    ~PathLocks() { release(); }
+
+    void lock(pthread_rwlock_t* rwlock, LockMode mode) {
+        if (mode == LockMode::EXCLUSIVE) pthread_rwlock_wrlock(rwlock);
+        else pthread_rwlock_rdlock(rwlock);
+        held.push_back(rwlock);
+    }
+
+    void lock(FSNode* node, LockMode mode) { lock(&node->lock, mode); }
+
+    void retire(InodeTable* inodes, FSNode* node) {
+        table = inodes;
+        retired.push_back(node->inode);
+    }
+
+    void release() {
+        for (auto it = held.rbegin(); it != held.rend(); ++it) {
+            pthread_rwlock_unlock(*it);
+        }
+        held.clear();
+        for (uint32_t inode : retired) {
+            table->release(inode);
+        }
+        retired.clear();
+    }
+};
+
+struct UserUsage {
+    uint64_t bytes;
+    uint64_t blocks;
+    uint32_t files;
+    uint64_t reserved_bytes;  // promised to operations still in flight (see reserve_quota)
+
+    UserUsage() : bytes(0), blocks(0), files(0), reserved_bytes(0) {}
+};
+
+// Per-owner totals, kept up to date alongside the subtree aggregates so
+// that neither get_stats nor get_user_usage has to walk the tree.
+struct FSCounters {
+    pthread_mutex_t lock;
+    HashMap<string, UserUsage> per_user;
+
+    FSCounters() { pthread_mutex_init(&lock, nullptr); }
+    ~FSCounters() { pthread_mutex_destroy(&lock); }
+};
+
 class FileSystem {
 private:
     FSNode* root;
-    uint32_t next_inode;
+    InodeTable inodes;
+    FSCounters counters;
     
-    void delete_tree(FSNode* node) {
-        if (!node) return;
-        vector<FSNode*> children = node->get_children();
-        for (auto* child : children) {
-            delete_tree(child);
+    // Held exclusively by moves and shared by anything that needs full_path()
+    // to stay valid; it also lets a move lock two branches of the tree at once.
+    pthread_rwlock_t rename_lock;
+    
+    // Caller holds counters.lock
+    UserUsage& usage_for(const string& owner) {
+        UserUsage* usage = counters.per_user.get(owner);
+        if (!usage) {
+            counters.per_user.insert(owner, UserUsage());
+            usage = counters.per_user.get(owner);
         }
-        delete node;
+        return *usage;
+    }
+    
+    void adjust_user(const string& owner, int64_t bytes, int64_t blocks, int32_t files) {
+        pthread_mutex_lock(&counters.lock);
+        UserUsage& usage = usage_for(owner);
+        usage.bytes += bytes;
+        usage.blocks += blocks;
+        usage.files += files;
+        pthread_mutex_unlock(&counters.lock);
+    }
+    
+    void propagate_usage(FSNode* dir, int64_t bytes, int64_t blocks, int32_t files, int32_t dirs) {
+        for (; dir; dir = dir->parent) {
+            dir->subtree_bytes += static_cast<uint64_t>(bytes);
+            dir->subtree_blocks += static_cast<uint64_t>(blocks);
+            dir->subtree_files += static_cast<uint32_t>(files);
+            dir->subtree_dirs += static_cast<uint32_t>(dirs);
+        }
+    }
+    
+    void count_added(FSNode* node) {
+        if (node->type == EntryType::DIRECTORY) {
+            propagate_usage(node->parent, 0, 0, 0, 1);
+        } else {
+            propagate_usage(node->parent, node->size, node->num_blocks, 1, 0);
+            adjust_user(node->owner, 0, 0, 1);
+        }
+    }
+    
+    void count_removed(FSNode* node) {
+        if (node->type == EntryType::DIRECTORY) {
+            propagate_usage(node->parent, 0, 0, 0, -1);
+            return;
+        }
+        propagate_usage(node->parent, -static_cast<int64_t>(node->size),
+                        -static_cast<int64_t>(node->num_blocks), -1, 0);
+        adjust_user(node->owner, -static_cast<int64_t>(node->size),
+                    -static_cast<int64_t>(node->num_blocks), -1);
     }
     
     vector<string> split_path(const string& path) {
@@ -446,6 +722,19 @@ private:
         return result;
     }
     
+    // Walks comps[begin..] below start (already locked by the caller), taking
+    // each step shared and the last one in last_mode
+    FSNode* descend(FSNode* start, const vector<string>& comps, size_t begin,
+                    PathLocks& locks, LockMode last_mode) {
+        FSNode* current = start;
+        for (size_t i = begin; i < comps.size(); i++) {
+            current = current->find_child(comps[i]);
+            if (!current) return nullptr;
+            locks.lock(current, i + 1 == comps.size() ? last_mode : LockMode::SHARED);
+        }
+        return current;
+    }
+    
     // NEW: Helper to resolve user-specific paths
     string resolve_user_path(const string& path, const string& username, bool is_admin) {
         // Admins can access any path
@@ -468,28 +757,33 @@ private:
     }
     
 public:
-    FileSystem() : next_inode(1) {
+    FileSystem() {
+        pthread_rwlock_init(&rename_lock, nullptr);
         root = new FSNode("/", EntryType::DIRECTORY, nullptr);
-        root->inode = 0;
+        inodes.allocate(root);
+        root->linked = true;
         root->created_time = time(nullptr);
         root->modified_time = root->created_time;
     }
     
     ~FileSystem() {
-        delete_tree(root);
+        pthread_rwlock_destroy(&rename_lock);
     }
     
     // NEW: Initialize /users directory structure
+    // Runs at startup or under an exclusive fs_lock, so no node locks are taken
     bool ensure_users_directory() {
         FSNode* users_dir = root->find_child("users");
         if (!users_dir) {
             users_dir = new FSNode("users", EntryType::DIRECTORY, root);
             users_dir->owner = "system";
-            users_dir->inode = next_inode++;
+            inodes.allocate(users_dir);
             users_dir->created_time = time(nullptr);
             users_dir->modified_time = users_dir->created_time;
             users_dir->permissions = 0755;
+            users_dir->linked = true;
             root->add_child(users_dir);
+            count_added(users_dir);
         }
         return true;
     }
@@ -508,15 +802,18 @@ public:
         
         FSNode* user_dir = new FSNode(username, EntryType::DIRECTORY, users_dir);
         user_dir->owner = username;
-        user_dir->inode = next_inode++;
+        inodes.allocate(user_dir);
         user_dir->created_time = time(nullptr);
         user_dir->modified_time = user_dir->created_time;
         user_dir->permissions = 0755;
+        user_dir->linked = true;
         users_dir->add_child(user_dir);
+        count_added(user_dir);
         
         return true;
     }
     
+    // Unlocked lookup; only safe while nothing else can touch the tree
     FSNode* find_node(const string& path) {
         if (path == "/" || path.empty()) return root;
         
@@ -530,61 +827,386 @@ public:
         return current;
     }
     
+    // Looks path up hand-over-hand: every ancestor is held shared, the parent
+    // in parent_mode and the node itself in mode. The locks stay with `locks`
+    // (also on failure) until the operation is done.
+    FSNode* lock_path(const string& path, PathLocks& locks, LockMode mode,
+                      LockMode parent_mode = LockMode::SHARED) {
+        vector<string> components = split_path(path);
+        if (components.empty()) {
+            locks.lock(root, mode);
+            return root;
+        }
+        
+        locks.lock(root, components.size() == 1 ? parent_mode : LockMode::SHARED);
+        FSNode* parent = descend(root, vector<string>(components.begin(), components.end() - 1),
+                                 0, locks, parent_mode);
+        if (!parent) return nullptr;
+        
+        FSNode* node = parent->find_child(components.back());
+        if (!node) return nullptr;
+        locks.lock(node, mode);
+        return node;
+    }
+    
+    // Resolves path through the published child indexes without taking any
+    // directory lock. Only valid while the caller is inside an epoch.
+    FSNode* find_published(const string& path) {
+        FSNode* current = root;
+        for (const auto& comp : split_path(path)) {
+            current = current->find_child(comp);
+            if (!current) return nullptr;
+        }
+        return current;
+    }
+    
+    // Read-side lookup: lock-free down to the node, which alone is locked.
+    // A node unlinked between the walk and the lock is reported as missing.
+    FSNode* lookup(const string& path, PathLocks& locks, LockMode mode = LockMode::SHARED) {
+        FSNode* node = find_published(path);
+        if (!node) return nullptr;
+        locks.lock(node, mode);
+        return node->linked ? node : nullptr;
+    }
+    
+    // The node is locked shared (or exclusive) and still linked into the tree
+    FSNode* lock_inode(uint32_t inode, uint32_t generation, PathLocks& locks, LockMode mode) {
+        locks.lock(&inodes.lock, LockMode::SHARED);
+        FSNode* node = inodes.get(inode, generation);
+        if (!node) return nullptr;
+        locks.lock(node, mode);
+        return node->linked ? node : nullptr;
+    }
+    
+    // Keeps every node's name and parent fixed so full_path() can be built
+    void hold_names(PathLocks& locks) {
+        locks.lock(&rename_lock, LockMode::SHARED);
+    }
+    
     // NEW: Find node with user context
     FSNode* find_node_for_user(const string& path, const string& username, bool is_admin) {
         string resolved_path = resolve_user_path(path, username, is_admin);
         return find_node(resolved_path);
     }
     
-    FSNode* create_node(const string& path, EntryType type, const string& owner) {
+    // Links a new node at path. The inode is taken before any node lock (the
+    // table lock always comes first), then the parent is locked exclusively
+    // and the new node is handed back locked exclusively as well, so the
+    // caller can finish filling it in before anyone else sees it.
+    FSNode* create_node(const string& path, EntryType type, const string& owner,
+                        PathLocks& locks, bool* exists = nullptr) {
         size_t last_slash = path.find_last_of('/');
         string parent_path = (last_slash == 0) ? "/" : path.substr(0, last_slash);
         string name = path.substr(last_slash + 1);
         
         if (name.empty()) return nullptr;
         
-        FSNode* parent = find_node(parent_path);
-        if (!parent || parent->type != EntryType::DIRECTORY) return nullptr;
-        
-        if (parent->find_child(name)) return nullptr;
-        
-        FSNode* node = new FSNode(name, type, parent);
+        FSNode* node = new FSNode(name, type, nullptr);
         node->owner = owner;
-        node->inode = next_inode++;
+        inodes.allocate(node);
         node->created_time = time(nullptr);
         node->modified_time = node->created_time;
         node->permissions = (type == EntryType::DIRECTORY) ? 0755 : 0644;
         
+        FSNode* parent = lock_path(parent_path, locks, LockMode::EXCLUSIVE);
+        if (!parent || parent->type != EntryType::DIRECTORY || parent->find_child(name)) {
+            if (exists) *exists = parent && parent->find_child(name);
+            locks.retire(&inodes, node);
+            return nullptr;
+        }
+        
+        node->parent = parent;
+        locks.lock(node, LockMode::EXCLUSIVE);
+        node->linked = true;
         parent->add_child(node);
+        count_added(node);
         return node;
     }
     
     // NEW: Create node with user context
-    FSNode* create_node_for_user(const string& path, EntryType type, const string& owner, bool is_admin) {
+    FSNode* create_node_for_user(const string& path, EntryType type, const string& owner, bool is_admin,
+                                 PathLocks& locks) {
         string resolved_path = resolve_user_path(path, owner, is_admin);
-        return create_node(resolved_path, type, owner);
+        return create_node(resolved_path, type, owner, locks);
+    }
+    
+    // Caller holds the parent and the node exclusively
+    void unlink_node(FSNode* node, PathLocks& locks) {
+        node->parent->remove_child(node->name);
+        node->linked = false;
+        count_removed(node);
+        locks.retire(&inodes, node);
     }
     
     bool delete_node(const string& path) {
-        FSNode* node = find_node(path);
+        PathLocks locks;
+        FSNode* node = lock_path(path, locks, LockMode::EXCLUSIVE, LockMode::EXCLUSIVE);
         if (!node || node == root) return false;
         
         if (node->type == EntryType::DIRECTORY && node->has_children()) {
             return false;
         }
         
-        node->parent->remove_child(node->name);
-        delete node;
+        unlink_node(node, locks);
+        return true;
+    }
+    
+    // Locks both ends of a move. Under rename_lock, the chain down to the
+    // lowest common ancestor of the two parents is taken first, then the two
+    // parent branches in name order, then the node itself. Only moves ever
+    // hold two branches, and they are serialized by rename_lock, so this
+    // cannot deadlock against the top-down walkers.
+    // Returns the node; new_parent stays null if the target is unusable.
+    FSNode* lock_for_move(const string& old_path, const string& new_path, PathLocks& locks,
+                          FSNode*& new_parent, string& new_name) {
+        new_parent = nullptr;
+        vector<string> from = split_path(old_path);
+        vector<string> to = split_path(new_path);
+        if (from.empty()) return nullptr;
+        
+        locks.lock(&rename_lock, LockMode::EXCLUSIVE);
+        
+        // A node cannot move below itself
+        bool usable = !to.empty() &&
+            !(to.size() > from.size() && equal(from.begin(), from.end(), to.begin()));
+        
+        string old_name = from.back();
+        from.pop_back();
+        if (usable) {
+            new_name = to.back();
+            to.pop_back();
+        }
+        
+        size_t common = 0;
+        if (usable) {
+            while (common < from.size() && common < to.size() && from[common] == to[common]) common++;
+        } else {
+            common = from.size();
+        }
+        
+        bool ancestor_is_parent = common == from.size() || (usable && common == to.size());
+        vector<string> shared_part(from.begin(), from.begin() + common);
+        FSNode* ancestor;
+        if (shared_part.empty()) {
+            locks.lock(root, ancestor_is_parent ? LockMode::EXCLUSIVE : LockMode::SHARED);
+            ancestor = root;
+        } else {
+            locks.lock(root, LockMode::SHARED);
+            ancestor = descend(root, shared_part, 0, locks,
+                               ancestor_is_parent ? LockMode::EXCLUSIVE : LockMode::SHARED);
+            if (!ancestor) return nullptr;
+        }
+        
+        // Sibling branches go in name order, so every move agrees on it
+        bool target_first = usable && common < from.size() && common < to.size() && to[common] < from[common];
+        FSNode* target_dir = nullptr;
+        if (target_first) target_dir = descend(ancestor, to, common, locks, LockMode::EXCLUSIVE);
+        
+        FSNode* old_parent = descend(ancestor, from, common, locks, LockMode::EXCLUSIVE);
+        if (!old_parent) return nullptr;
+        
+        if (usable && !target_first) target_dir = descend(ancestor, to, common, locks, LockMode::EXCLUSIVE);
+        if (target_dir && target_dir->type == EntryType::DIRECTORY) new_parent = target_dir;
+        
+        FSNode* node = old_parent->find_child(old_name);
+        if (!node) return nullptr;
+        locks.lock(node, LockMode::EXCLUSIVE);
+        return node;
+    }
+    
+    // Re-parents node under new_parent by relinking pointers; the subtree below
+    // it moves with it untouched. Only the ancestors' aggregates are adjusted.
+    // Caller holds the locks from lock_for_move.
+    bool move_node(FSNode* node, FSNode* new_parent, const string& new_name) {
+        if (!node || node == root || !new_parent || new_name.empty()) return false;
+        if (new_parent->find_child(new_name)) return false;
+        
+        for (FSNode* ancestor = new_parent; ancestor; ancestor = ancestor->parent) {
+            if (ancestor == node) return false;
+        }
+        
+        int64_t bytes, blocks;
+        int32_t files, dirs;
+        if (node->type == EntryType::DIRECTORY) {
+            bytes = node->subtree_bytes;
+            blocks = node->subtree_blocks;
+            files = node->subtree_files;
+            dirs = node->subtree_dirs + 1;
+        } else {
+            bytes = node->size;
+            blocks = node->num_blocks;
+            files = 1;
+            dirs = 0;
+        }
+        
+        FSNode* old_parent = node->parent;
+        old_parent->remove_child(node->name);
+        propagate_usage(old_parent, -bytes, -blocks, -files, -dirs);
+        
+        node->name = new_name;
+        node->parent = new_parent;
+        new_parent->add_child(node);
+        propagate_usage(new_parent, bytes, blocks, files, dirs);
+        
+        return true;
+    }
+    
+    // Takes every node below node exclusively, parents before children.
+    // Caller already holds node itself exclusively.
+    void lock_subtree(FSNode* node, PathLocks& locks) {
+        vector<FSNode*> stack{node};
+        while (!stack.empty()) {
+            FSNode* current = stack.back();
+            stack.pop_back();
+            if (current->type != EntryType::DIRECTORY) continue;
+            for (auto* child : current->get_children()) {
+                locks.lock(child, LockMode::EXCLUSIVE);
+                stack.push_back(child);
+            }
+        }
+    }
+    
+    bool subtree_owned_by(FSNode* node, const string& owner) {
+        vector<FSNode*> stack{node};
+        while (!stack.empty()) {
+            FSNode* current = stack.back();
+            stack.pop_back();
+            if (current->owner != owner) return false;
+            if (current->type == EntryType::DIRECTORY) {
+                for (auto* child : current->get_children()) stack.push_back(child);
+            }
+        }
         return true;
     }
     
+    // Unlinks node and everything below it in a single pass. The aggregates
+    // are adjusted once at the detach point, and the block allocations of the
+    // removed files are collected so the caller can free them in one batch.
+    // Caller holds the parent and the whole subtree exclusively (lock_subtree).
+    uint32_t delete_subtree(FSNode* node, PathLocks& locks, vector<uint32_t>& freed_allocations) {
+        if (!node || node == root) return 0;
+        
+        FSNode* parent = node->parent;
+        parent->remove_child(node->name);
+        if (node->type == EntryType::DIRECTORY) {
+            propagate_usage(parent, -static_cast<int64_t>(node->subtree_bytes),
+                            -static_cast<int64_t>(node->subtree_blocks),
+                            -static_cast<int32_t>(node->subtree_files),
+                            -static_cast<int32_t>(node->subtree_dirs) - 1);
+        } else {
+            propagate_usage(parent, -static_cast<int64_t>(node->size),
+                            -static_cast<int64_t>(node->num_blocks), -1, 0);
+        }
+        
+        uint32_t removed = 0;
+        vector<FSNode*> stack{node};
+        while (!stack.empty()) {
+            FSNode* current = stack.back();
+            stack.pop_back();
+            
+            if (current->type == EntryType::DIRECTORY) {
+                for (auto* child : current->get_children()) stack.push_back(child);
+            } else {
+                adjust_user(current->owner, -static_cast<int64_t>(current->size),
+                            -static_cast<int64_t>(current->num_blocks), -1);
+                if (current->start_block != 0) freed_allocations.push_back(current->start_block);
+            }
+            
+            current->linked = false;
+            locks.retire(&inodes, current);
+            removed++;
+        }
+        return removed;
+    }
+    
     // NEW: Delete node with user context
     bool delete_node_for_user(const string& path, const string& username, bool is_admin) {
         string resolved_path = resolve_user_path(path, username, is_admin);
         return delete_node(resolved_path);
     }
     
+    // Caller holds the node exclusively
+    void resize_file(FSNode* node, uint64_t new_size, uint32_t new_blocks) {
+        int64_t byte_delta = static_cast<int64_t>(new_size) - static_cast<int64_t>(node->size);
+        int64_t block_delta = static_cast<int64_t>(new_blocks) - static_cast<int64_t>(node->num_blocks);
+        propagate_usage(node->parent, byte_delta, block_delta, 0, 0);
+        adjust_user(node->owner, byte_delta, block_delta, 0);
+        
+        node->size = new_size;
+        node->num_blocks = new_blocks;
+    }
+    
+    // Home directory (/users/<name>) containing node, or nullptr outside /users
+    FSNode* home_of(FSNode* node) {
+        FSNode* users_dir = root->find_child("users");
+        if (!users_dir) return nullptr;
+        
+        for (; node && node->parent; node = node->parent) {
+            if (node->parent == users_dir) return node;
+        }
+        return nullptr;
+    }
+    
+    // Bytes reserve_quota promised to one operation; dropping the hold gives
+    // them back. By then the operation has either charged what it wrote to
+    // the owner's usage or failed.
+    class QuotaHold {
+        friend class FileSystem;
+        FileSystem* fs = nullptr;
+        string owner;
+        uint64_t bytes = 0;
+    public:
+        QuotaHold() = default;
+        QuotaHold(const QuotaHold&) = delete;
+        QuotaHold& operator=(const QuotaHold&) = delete;
+        ~QuotaHold() {
+            if (!fs) return;
+            pthread_mutex_lock(&fs->counters.lock);
+            fs->usage_for(owner).reserved_bytes -= bytes;
+            pthread_mutex_unlock(&fs->counters.lock);
+        }
+    };
+    
+    // Whether the home directory holding dir (if any) has room for extra_bytes
+    bool home_has_room(FSNode* dir, uint64_t extra_bytes, uint64_t quota) {
+        if (quota == 0) return true;
+        FSNode* home = home_of(dir);
+        return !home || home->subtree_bytes + extra_bytes <= quota;
+    }
+    
+    // Takes extra_bytes of node's owner's quota for the caller: the owner's
+    // usage, wherever in the tree it is, plus what other operations have
+    // reserved must leave room for them. The check and the reservation are
+    // one step under counters.lock, so concurrent writers cannot all pass
+    // and overshoot. The home directory node is in is checked as well.
+    bool reserve_quota(FSNode* node, uint64_t extra_bytes, uint64_t quota, QuotaHold& hold) {
+        if (quota == 0 || extra_bytes == 0) return true;
+        if (!home_has_room(node, extra_bytes, quota)) return false;
+        
+        pthread_mutex_lock(&counters.lock);
+        UserUsage& usage = usage_for(node->owner);
+        bool fits = usage.bytes + usage.reserved_bytes + extra_bytes <= quota;
+        if (fits) usage.reserved_bytes += extra_bytes;
+        pthread_mutex_unlock(&counters.lock);
+        
+        if (fits) {
+            hold.fs = this;
+            hold.owner = node->owner;
+            hold.bytes += extra_bytes;
+        }
+        return fits;
+    }
+    
+    UserUsage get_user_usage(const string& owner) {
+        pthread_mutex_lock(&counters.lock);
+        const UserUsage* usage = counters.per_user.get(owner);
+        UserUsage result = usage ? *usage : UserUsage();
+        pthread_mutex_unlock(&counters.lock);
+        return result;
+    }
+    
     FSNode* get_root() { return root; }
+    uint32_t get_node_count() { return inodes.size(); }
 };
 
 #endif
\ No newline at end of file
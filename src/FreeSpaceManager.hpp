@@ -8,6 +8,9 @@
 #include <iomanip>
 #include <algorithm>
 #include <cstdint>
+#include <climits>
+#include <atomic>
+#include <pthread.h>
 #include "HashMap.hpp"
 
 using namespace std;
@@ -81,6 +84,10 @@ public:
 
 #define BLOCK_METADATA_SIZE 64
 
+// Allocation entry with no block behind it: a hole in a sparse file, which
+// reads back as zeros until something is written there
+#define HOLE_BLOCK UINT32_MAX
+
 struct BlockMetadata {
     uint32_t file_id;
     uint32_t sequence_number;
@@ -90,100 +97,555 @@ struct BlockMetadata {
     uint8_t reserved[32];
 };
 
-class FreeSpaceManager {
-private:
+// One slice of the block range with its own lock, so threads allocating from
+// different shards never contend. An allocation id records the shard that owns
+// its block list: file_id = seq * shard_count + shard + 1.
+struct AllocShard {
+    pthread_mutex_t lock;
+    uint32_t first_block;
+    uint32_t num_blocks;
     Bitmap bitmap;
-    uint32_t total_blocks;
+    HashMap<uint32_t, uint32_t> block_refs;  // holders beyond the first, for blocks shared by file_copy
+    // Dedup index of this shard's blocks: content fingerprint <-> block. A
+    // block leaves it under the same lock that frees it.
+    HashMap<uint64_t, uint32_t> fingerprints;
+    HashMap<uint32_t, uint64_t> block_fingerprints;
     HashMap<uint32_t, vector<uint32_t>> file_block_map;
     HashMap<uint32_t, BlockMetadata> block_metadata_map;
-    uint32_t next_file_id;
+    uint32_t next_seq;
+
+    AllocShard() : first_block(0), num_blocks(0), next_seq(0) {
+        pthread_mutex_init(&lock, nullptr);
+    }
+
+    ~AllocShard() { pthread_mutex_destroy(&lock); }
+};
+
+struct ShardGuard {
+    pthread_mutex_t* lock;
+    ShardGuard(AllocShard& shard) : lock(&shard.lock) { pthread_mutex_lock(lock); }
+    ~ShardGuard() { pthread_mutex_unlock(lock); }
+};
+
+#define MAX_ALLOC_SHARDS 16
+#define MIN_BLOCKS_PER_SHARD 256
+
+class FreeSpaceManager {
+private:
+    AllocShard* shards;
+    uint32_t shard_count;
+    uint32_t shard_span;
+    uint32_t total_blocks;
+    atomic<uint32_t> free_count;
+    atomic<uint32_t> shared_refs;
+    atomic<uint32_t> indexed_blocks;
+    atomic<uint32_t> next_home;
+
+    AllocShard& shard_of_block(uint32_t block) const { return shards[block / shard_span]; }
+    AllocShard& shard_of_file(uint32_t file_id) const { return shards[(file_id - 1) % shard_count]; }
+
+    // Each thread keeps allocating from the same shard, so workers spread
+    // across the shards instead of all scanning from block 0
+    AllocShard& home_shard() {
+        static thread_local uint32_t home = UINT32_MAX;
+        if (home == UINT32_MAX) home = next_home++;
+        return shards[home % shard_count];
+    }
+
+    // Caller holds shard.lock
+    void take_blocks(AllocShard& shard, uint32_t file_id, uint32_t count, vector<uint32_t>& allocated) {
+        for (uint32_t i = 0; i < shard.num_blocks && count > 0; i++) {
+            if (!shard.bitmap.is_free(i)) continue;
+            shard.bitmap.set_bit(i);
+            uint32_t block = shard.first_block + i;
+
+            BlockMetadata meta{};
+            meta.file_id = file_id;
+            meta.sequence_number = allocated.size();
+            meta.data_size = 0;
+            meta.next_block = 0;
+            meta.timestamp = static_cast<uint32_t>(time(nullptr));
+            shard.block_metadata_map.insert(block, meta);
+
+            if (!allocated.empty()) {
+                BlockMetadata* prev = shard_of_block(allocated.back()).block_metadata_map.get(allocated.back());
+                if (prev) prev->next_block = block;
+            }
+            allocated.push_back(block);
+            count--;
+        }
+    }
+
+    static uint32_t count_holes(const vector<uint32_t>& blocks, uint32_t first, uint32_t last) {
+        uint32_t holes = 0;
+        for (uint32_t i = first; i < last && i < blocks.size(); i++) {
+            if (blocks[i] == HOLE_BLOCK) holes++;
+        }
+        return holes;
+    }
+
+    // Puts fresh blocks, in order, into the holes among entries [first, last)
+    static void place_blocks(vector<uint32_t>& blocks, uint32_t first, uint32_t last, const vector<uint32_t>& fresh) {
+        size_t next = 0;
+        for (uint32_t i = first; i < last && i < blocks.size() && next < fresh.size(); i++) {
+            if (blocks[i] == HOLE_BLOCK) blocks[i] = fresh[next++];
+        }
+    }
+
+    // Groups blocks by shard and hands each group to apply under its shard's
+    // lock, taking one lock at a time; holes are skipped
+    template <typename F>
+    void for_each_shard(const vector<uint32_t>& blocks, F apply) {
+        vector<uint32_t> batch;
+        size_t i = 0;
+        while (i < blocks.size()) {
+            if (blocks[i] == HOLE_BLOCK) {
+                i++;
+                continue;
+            }
+            AllocShard& shard = shard_of_block(blocks[i]);
+            batch.clear();
+            for (; i < blocks.size() && (blocks[i] == HOLE_BLOCK || &shard_of_block(blocks[i]) == &shard); i++) {
+                if (blocks[i] != HOLE_BLOCK) batch.push_back(blocks[i]);
+            }
+            ShardGuard guard(shard);
+            apply(shard, batch);
+        }
+    }
+
+    // Drops one hold on each block; a block is freed with its last holder.
+    // Returns how many blocks were freed.
+    uint32_t release_blocks(const vector<uint32_t>& blocks) {
+        uint32_t freed = 0;
+        for_each_shard(blocks, [&](AllocShard& shard, const vector<uint32_t>& batch) {
+            for (uint32_t block : batch) {
+                uint32_t* refs = shard.block_refs.get(block);
+                if (refs) {
+                    if (--*refs == 0) shard.block_refs.erase(block);
+                    shared_refs--;
+                    continue;
+                }
+                if (shard.bitmap.clear_bit(block - shard.first_block)) {
+                    free_count++;
+                    freed++;
+                }
+                shard.block_metadata_map.erase(block);
+                unindex(shard, block);
+            }
+        });
+        return freed;
+    }
+
+    void retain_blocks(const vector<uint32_t>& blocks) {
+        for_each_shard(blocks, [&](AllocShard& shard, const vector<uint32_t>& batch) {
+            for (uint32_t block : batch) {
+                uint32_t* refs = shard.block_refs.get(block);
+                if (refs) (*refs)++;
+                else shard.block_refs.insert(block, 1);
+                shared_refs++;
+            }
+        });
+    }
+
+    // Caller holds shard.lock
+    void unindex(AllocShard& shard, uint32_t block) {
+        const uint64_t* fingerprint = shard.block_fingerprints.get(block);
+        if (!fingerprint) return;
+        shard.fingerprints.erase(*fingerprint);
+        shard.block_fingerprints.erase(block);
+        indexed_blocks--;
+    }
+
+    // Whether a block about to be written has to be copied first. One that
+    // is not shared is written in place, so it leaves the dedup index in the
+    // same step: nobody can take a share of it after this.
+    bool needs_copy(uint32_t block) {
+        AllocShard& shard = shard_of_block(block);
+        ShardGuard guard(shard);
+        if (shard.block_refs.get(block)) return true;
+        unindex(shard, block);
+        return false;
+    }
+
+    // Turns the entries from first on that have a block in changed into
+    // holes, or puts those blocks back
+    void set_entries(uint32_t file_id, uint32_t first, const vector<uint32_t>& changed, bool to_holes) {
+        AllocShard& owner = shard_of_file(file_id);
+        ShardGuard guard(owner);
+        vector<uint32_t>* blocks = owner.file_block_map.get(file_id);
+        if (!blocks) return;
+        for (size_t i = 0; i < changed.size() && first + i < blocks->size(); i++) {
+            if (changed[i] != HOLE_BLOCK) (*blocks)[first + i] = to_holes ? HOLE_BLOCK : changed[i];
+        }
+    }
+
+    bool detach_file(uint32_t file_id, vector<uint32_t>& blocks) {
+        if (file_id == 0) return false;
+        AllocShard& shard = shard_of_file(file_id);
+        ShardGuard guard(shard);
+        vector<uint32_t>* found = shard.file_block_map.get(file_id);
+        if (!found) return false;
+        blocks.swap(*found);
+        shard.file_block_map.erase(file_id);
+        return true;
+    }
 
 public:
-    FreeSpaceManager() : total_blocks(0), next_file_id(1) {}
+    FreeSpaceManager() : shards(nullptr), shard_count(0), shard_span(0), total_blocks(0),
+                         free_count(0), shared_refs(0), indexed_blocks(0), next_home(0) {}
+
+    ~FreeSpaceManager() { delete[] shards; }
 
     void initialize(uint32_t num_blocks) {
+        delete[] shards;
         total_blocks = num_blocks;
-        bitmap.initialize(num_blocks);
-        file_block_map.clear();
-        block_metadata_map.clear();
-        next_file_id = 1;
+        shard_count = min<uint32_t>(MAX_ALLOC_SHARDS, max<uint32_t>(1, num_blocks / MIN_BLOCKS_PER_SHARD));
+        shard_span = max<uint32_t>(1, (num_blocks + shard_count - 1) / shard_count);
+        shards = new AllocShard[shard_count];
+
+        for (uint32_t i = 0; i < shard_count; i++) {
+            shards[i].first_block = min(num_blocks, i * shard_span);
+            shards[i].num_blocks = min(num_blocks - shards[i].first_block, shard_span);
+            shards[i].bitmap.initialize(shards[i].num_blocks);
+        }
+        free_count = num_blocks;
+        shared_refs = 0;
+        indexed_blocks = 0;
     }
 
     uint32_t allocate_blocks(uint32_t count) {
-        if (count == 0 || count > bitmap.get_free_count())
+        if (count == 0 || count > free_count)
             return 0;
 
+        AllocShard& home = home_shard();
+        uint32_t home_index = &home - shards;
         vector<uint32_t> allocated_blocks;
-        for (uint32_t i = 0; i < total_blocks && allocated_blocks.size() < count; i++) {
-            if (bitmap.is_free(i)) {
-                bitmap.set_bit(i);
-                allocated_blocks.push_back(i);
-
-                BlockMetadata meta{};
-                meta.file_id = next_file_id;
-                meta.sequence_number = allocated_blocks.size() - 1;
-                meta.data_size = 0;
-                meta.next_block = 0;
-                meta.timestamp = static_cast<uint32_t>(time(nullptr));
-                block_metadata_map.insert(i, meta);
+        uint32_t file_id = 0;
+
+        {
+            ShardGuard guard(home);
+            if (home.bitmap.get_free_count() >= count) {
+                file_id = home.next_seq++ * shard_count + home_index + 1;
+                take_blocks(home, file_id, count, allocated_blocks);
+                free_count -= count;
+                home.file_block_map.insert(file_id, allocated_blocks);
             }
         }
 
-        if (allocated_blocks.size() != count) {
-            for (uint32_t block : allocated_blocks)
-                bitmap.clear_bit(block);
-            return 0;
-        }
-
-        for (size_t i = 0; i < allocated_blocks.size(); i++) {
-            if (i + 1 < allocated_blocks.size()) {
-                BlockMetadata* m = block_metadata_map.get(allocated_blocks[i]);
-                if (m) m->next_block = allocated_blocks[i + 1];
+        if (file_id == 0) {
+            // Spills over into other shards: lock them all in index order
+            for (uint32_t i = 0; i < shard_count; i++) pthread_mutex_lock(&shards[i].lock);
+
+            uint32_t available = 0;
+            for (uint32_t i = 0; i < shard_count; i++) available += shards[i].bitmap.get_free_count();
+
+            if (available >= count) {
+                file_id = home.next_seq++ * shard_count + home_index + 1;
+                for (uint32_t i = 0; i < shard_count && allocated_blocks.size() < count; i++) {
+                    AllocShard& shard = shards[(home_index + i) % shard_count];
+                    take_blocks(shard, file_id, count - allocated_blocks.size(), allocated_blocks);
+                }
+                free_count -= count;
+                home.file_block_map.insert(file_id, allocated_blocks);
             }
+
+            for (uint32_t i = shard_count; i-- > 0;) pthread_mutex_unlock(&shards[i].lock);
+            if (file_id == 0) return 0;
         }
 
-        file_block_map.insert(next_file_id, allocated_blocks);
-        uint32_t file_id = next_file_id++;
         cout << "✓ Allocated " << count << " blocks for file_id: " << file_id << "\n";
         return file_id;
     }
 
+    // A new allocation of count holes: a sparse file with no blocks yet
+    uint32_t allocate_holes(uint32_t count) {
+        if (shard_count == 0) return 0;
+        AllocShard& home = home_shard();
+        uint32_t home_index = &home - shards;
+        ShardGuard guard(home);
+        uint32_t file_id = home.next_seq++ * shard_count + home_index + 1;
+        home.file_block_map.insert(file_id, vector<uint32_t>(count, HOLE_BLOCK));
+        return file_id;
+    }
+
+    bool extend_holes(uint32_t file_id, uint32_t count) {
+        if (file_id == 0 || shard_count == 0) return false;
+        AllocShard& owner = shard_of_file(file_id);
+        ShardGuard guard(owner);
+        vector<uint32_t>* blocks = owner.file_block_map.get(file_id);
+        if (!blocks) return false;
+        blocks->insert(blocks->end(), count, HOLE_BLOCK);
+        return true;
+    }
+
+    // Backs every hole among entries [first, last) of an allocation with a
+    // block: from the owning shard when it has room, otherwise from wherever
+    // there is room. Returns how many holes it filled, or -1 (filling none)
+    // when there is not enough free space.
+    int fill_holes(uint32_t file_id, uint32_t first, uint32_t last) {
+        if (file_id == 0 || shard_count == 0) return -1;
+
+        AllocShard& owner = shard_of_file(file_id);
+        uint32_t owner_index = &owner - shards;
+        vector<uint32_t> fresh;
+        {
+            ShardGuard guard(owner);
+            vector<uint32_t>* blocks = owner.file_block_map.get(file_id);
+            if (!blocks) return -1;
+            uint32_t holes = count_holes(*blocks, first, last);
+            if (holes == 0) return 0;
+            if (owner.bitmap.get_free_count() >= holes) {
+                take_blocks(owner, file_id, holes, fresh);
+                free_count -= holes;
+                place_blocks(*blocks, first, last, fresh);
+                return holes;
+            }
+        }
+
+        for (uint32_t i = 0; i < shard_count; i++) pthread_mutex_lock(&shards[i].lock);
+
+        vector<uint32_t>* blocks = owner.file_block_map.get(file_id);
+        uint32_t holes = blocks ? count_holes(*blocks, first, last) : 0;
+        uint32_t available = 0;
+        for (uint32_t i = 0; i < shard_count; i++) available += shards[i].bitmap.get_free_count();
+
+        int filled = -1;
+        if (blocks && available >= holes) {
+            for (uint32_t i = 0; i < shard_count && fresh.size() < holes; i++) {
+                take_blocks(shards[(owner_index + i) % shard_count], file_id, holes - fresh.size(), fresh);
+            }
+            free_count -= holes;
+            place_blocks(*blocks, first, last, fresh);
+            filled = holes;
+        }
+
+        for (uint32_t i = shard_count; i-- > 0;) pthread_mutex_unlock(&shards[i].lock);
+        return filled;
+    }
+
+    // Drops every entry of an allocation past the first keep; returns how
+    // many blocks that released (holes have none)
+    uint32_t shrink_blocks(uint32_t file_id, uint32_t keep) {
+        if (file_id == 0 || shard_count == 0) return 0;
+
+        vector<uint32_t> released;
+        uint32_t last = 0;
+        {
+            AllocShard& owner = shard_of_file(file_id);
+            ShardGuard guard(owner);
+            vector<uint32_t>* blocks = owner.file_block_map.get(file_id);
+            if (!blocks || keep >= blocks->size()) return 0;
+            for (size_t i = keep; i < blocks->size(); i++) {
+                if ((*blocks)[i] != HOLE_BLOCK) released.push_back((*blocks)[i]);
+            }
+            blocks->resize(keep);
+            if (keep > 0) last = blocks->back();
+        }
+
+        release_blocks(released);
+        if (keep > 0 && last != HOLE_BLOCK) {
+            AllocShard& shard = shard_of_block(last);
+            ShardGuard guard(shard);
+            BlockMetadata* meta = shard.block_metadata_map.get(last);
+            if (meta) meta->next_block = 0;
+        }
+        cout << "✓ Released " << released.size() << " blocks from file_id: " << file_id << "\n";
+        return released.size();
+    }
+
+    // Turns entries [first, last) of an allocation into holes; returns how
+    // many blocks that released
+    uint32_t punch_holes(uint32_t file_id, uint32_t first, uint32_t last) {
+        if (file_id == 0 || shard_count == 0) return 0;
+        vector<uint32_t> released;
+        {
+            AllocShard& owner = shard_of_file(file_id);
+            ShardGuard guard(owner);
+            vector<uint32_t>* blocks = owner.file_block_map.get(file_id);
+            if (!blocks) return 0;
+            for (uint32_t i = first; i < last && i < blocks->size(); i++) {
+                if ((*blocks)[i] == HOLE_BLOCK) continue;
+                released.push_back((*blocks)[i]);
+                (*blocks)[i] = HOLE_BLOCK;
+            }
+        }
+        release_blocks(released);
+        return released.size();
+    }
+
+    // A new allocation holding the same blocks as file_id, each now shared
+    // by one more holder; nothing is copied. Returns 0 if file_id is unknown.
+    uint32_t share_blocks(uint32_t file_id) {
+        vector<uint32_t> blocks = get_file_blocks(file_id);
+        if (blocks.empty()) return 0;
+        retain_blocks(blocks);
+
+        AllocShard& home = home_shard();
+        uint32_t home_index = &home - shards;
+        ShardGuard guard(home);
+        uint32_t new_id = home.next_seq++ * shard_count + home_index + 1;
+        home.file_block_map.insert(new_id, blocks);
+        return new_id;
+    }
+
+    // Gives every shared block among entries [first, last) of an allocation a
+    // block of its own, in the same place; the others are about to be written
+    // in place (see needs_copy). replaced gets one entry per index
+    // in the range: the shared block it held, or HOLE_BLOCK if it was left
+    // alone. The allocation keeps its hold on the replaced blocks until the
+    // caller has copied what it needs from them and calls drop_blocks.
+    // Returns how many were replaced, or -1 (replacing none) when there is
+    // not enough free space.
+    int unshare_blocks(uint32_t file_id, uint32_t first, uint32_t last, vector<uint32_t>& replaced) {
+        vector<uint32_t> blocks = get_file_blocks(file_id, first, last - first);
+        replaced.assign(blocks.size(), HOLE_BLOCK);
+        int shared = 0;
+        for (size_t i = 0; i < blocks.size(); i++) {
+            if (blocks[i] != HOLE_BLOCK && needs_copy(blocks[i])) {
+                replaced[i] = blocks[i];
+                shared++;
+            }
+        }
+        if (shared == 0) return 0;
+
+        // The replaced entries become holes and are filled like any other
+        set_entries(file_id, first, replaced, true);
+        if (fill_holes(file_id, first, last) < 0) {
+            set_entries(file_id, first, replaced, false);
+            return -1;
+        }
+        return shared;
+    }
+
+    // Drops the holds unshare_blocks left on the blocks it replaced
+    void drop_blocks(const vector<uint32_t>& blocks) {
+        release_blocks(blocks);
+    }
+
+    // Records the fingerprint of a block just written for dedup. If the
+    // shard already has a block with that fingerprint, that one stays.
+    void add_fingerprint(uint32_t block, uint64_t fingerprint) {
+        AllocShard& shard = shard_of_block(block);
+        ShardGuard guard(shard);
+        if (shard.fingerprints.get(fingerprint) || shard.block_fingerprints.get(block)) return;
+        shard.fingerprints.insert(fingerprint, block);
+        shard.block_fingerprints.insert(block, fingerprint);
+        indexed_blocks++;
+    }
+
+    // An indexed block with this fingerprint, other than except, with a hold
+    // taken on it for the caller; HOLE_BLOCK if there is none. The caller
+    // still has to compare contents, a fingerprint match is only likely.
+    uint32_t share_fingerprint(uint64_t fingerprint, uint32_t except) {
+        if (indexed_blocks == 0) return HOLE_BLOCK;
+        for (uint32_t i = 0; i < shard_count; i++) {
+            ShardGuard guard(shards[i]);
+            const uint32_t* block = shards[i].fingerprints.get(fingerprint);
+            if (!block || *block == except) continue;
+            uint32_t* refs = shards[i].block_refs.get(*block);
+            if (refs) (*refs)++;
+            else shards[i].block_refs.insert(*block, 1);
+            shared_refs++;
+            return *block;
+        }
+        return HOLE_BLOCK;
+    }
+
+    void hold_block(uint32_t block) {
+        retain_blocks({block});
+    }
+
+    // Points entry index of an allocation at block, which the caller already
+    // holds for it, and drops the allocation's hold on the block it replaces
+    void replace_block(uint32_t file_id, uint32_t index, uint32_t block) {
+        uint32_t old = HOLE_BLOCK;
+        {
+            AllocShard& owner = shard_of_file(file_id);
+            ShardGuard guard(owner);
+            vector<uint32_t>* blocks = owner.file_block_map.get(file_id);
+            if (blocks && index < blocks->size()) {
+                old = (*blocks)[index];
+                (*blocks)[index] = block;
+            }
+        }
+        release_blocks({old});
+    }
+
     int allocate_single_block() {
         uint32_t file_id = allocate_blocks(1);
         if (file_id == 0) return -1;
-        vector<uint32_t>* blocks = file_block_map.get(file_id);
-        return blocks ? (*blocks)[0] : -1;
+        vector<uint32_t> blocks = get_file_blocks(file_id);
+        return blocks.empty() ? -1 : blocks[0];
     }
 
     bool free_blocks(uint32_t start, uint32_t count) {
-        vector<uint32_t>* blocks = file_block_map.get(start);
-        if (blocks) {
-            for (uint32_t block : *blocks) {
-                bitmap.clear_bit(block);
-                block_metadata_map.erase(block);
-            }
-            file_block_map.erase(start);
+        vector<uint32_t> blocks;
+        if (detach_file(start, blocks)) {
+            release_blocks(blocks);
             cout << "✓ Freed all blocks for file_id: " << start << "\n";
             return true;
         }
 
         if (start + count > total_blocks) return false;
         for (uint32_t i = start; i < start + count; i++) {
-            bitmap.clear_bit(i);
-            block_metadata_map.erase(i);
+            blocks.push_back(i);
         }
+        release_blocks(blocks);
         return true;
     }
 
+    // Releases several allocations at once, e.g. every file under a directory
+    // removed by dir_delete_recursive
+    uint32_t free_many(const vector<uint32_t>& file_ids) {
+        vector<uint32_t> all_blocks;
+        for (uint32_t file_id : file_ids) {
+            vector<uint32_t> blocks;
+            if (!detach_file(file_id, blocks)) continue;
+            all_blocks.insert(all_blocks.end(), blocks.begin(), blocks.end());
+        }
+        sort(all_blocks.begin(), all_blocks.end());
+        uint32_t freed = release_blocks(all_blocks);
+        cout << "✓ Freed " << freed << " blocks for " << file_ids.size() << " files\n";
+        return freed;
+    }
+
     bool free_single_block(uint32_t block) {
-        block_metadata_map.erase(block);
-        return bitmap.clear_bit(block);
+        if (block >= total_blocks) return false;
+        AllocShard& shard = shard_of_block(block);
+        ShardGuard guard(shard);
+        shard.block_metadata_map.erase(block);
+        bool was_allocated = shard.bitmap.clear_bit(block - shard.first_block);
+        if (was_allocated) free_count++;
+        return was_allocated;
     }
 
-    bool is_block_free(uint32_t block) const { return bitmap.is_free(block); }
-    uint32_t get_free_blocks() const { return bitmap.get_free_count(); }
+    bool is_block_free(uint32_t block) const {
+        if (block >= total_blocks) return false;
+        AllocShard& shard = shard_of_block(block);
+        ShardGuard guard(shard);
+        return shard.bitmap.is_free(block - shard.first_block);
+    }
+
+    uint32_t get_free_blocks() const { return free_count; }
+    uint32_t get_shared_refs() const { return shared_refs; }
+    uint32_t get_indexed_blocks() const { return indexed_blocks; }
+
+    size_t get_index_memory_size() const {
+        size_t bytes = 0;
+        for (uint32_t i = 0; i < shard_count; i++) {
+            ShardGuard guard(shards[i]);
+            bytes += shards[i].fingerprints.memory_usage() + shards[i].block_fingerprints.memory_usage();
+        }
+        return bytes;
+    }
     uint32_t get_total_blocks() const { return total_blocks; }
-    uint32_t get_bitmap_memory_size() const { return bitmap.get_bitmap_size(); }
+    uint32_t get_shard_count() const { return shard_count; }
+
+    uint32_t get_bitmap_memory_size() const {
+        uint32_t bytes = 0;
+        for (uint32_t i = 0; i < shard_count; i++) bytes += shards[i].bitmap.get_bitmap_size();
+        return bytes;
+    }
 
     double get_fragmentation_percentage() const {
         if (total_blocks == 0) return 0.0;
@@ -192,7 +654,10 @@ public:
     }
 
     bool read_block_metadata(uint32_t block, BlockMetadata& meta) const {
-        const BlockMetadata* ptr = block_metadata_map.get(block);
+        if (block >= total_blocks) return false;
+        AllocShard& shard = shard_of_block(block);
+        ShardGuard guard(shard);
+        const BlockMetadata* ptr = shard.block_metadata_map.get(block);
         if (!ptr) return false;
         meta = *ptr;
         return true;
@@ -200,12 +665,17 @@ public:
 
     bool write_block_metadata(uint32_t block, const BlockMetadata& meta) {
         if (block >= total_blocks) return false;
-        block_metadata_map.insert(block, meta);
+        AllocShard& shard = shard_of_block(block);
+        ShardGuard guard(shard);
+        shard.block_metadata_map.insert(block, meta);
         return true;
     }
 
     bool update_block_metadata(uint32_t block, uint32_t data_size, uint32_t next_block) {
-        BlockMetadata* m = block_metadata_map.get(block);
+        if (block >= total_blocks) return false;
+        AllocShard& shard = shard_of_block(block);
+        ShardGuard guard(shard);
+        BlockMetadata* m = shard.block_metadata_map.get(block);
         if (!m) return false;
         m->data_size = data_size;
         m->next_block = next_block;
@@ -213,33 +683,55 @@ public:
     }
 
     vector<uint32_t> get_file_blocks(uint32_t file_id) const {
-        const vector<uint32_t>* blocks = file_block_map.get(file_id);
+        if (file_id == 0 || shard_count == 0) return {};
+        AllocShard& shard = shard_of_file(file_id);
+        ShardGuard guard(shard);
+        const vector<uint32_t>* blocks = shard.file_block_map.get(file_id);
         if (blocks) return *blocks;
         return {};
     }
 
+    // Entries [first, first + count) of an allocation, fewer if it is shorter
+    vector<uint32_t> get_file_blocks(uint32_t file_id, uint32_t first, uint32_t count) const {
+        if (file_id == 0 || shard_count == 0) return {};
+        AllocShard& shard = shard_of_file(file_id);
+        ShardGuard guard(shard);
+        const vector<uint32_t>* blocks = shard.file_block_map.get(file_id);
+        if (!blocks || first >= blocks->size()) return {};
+        size_t end = min<size_t>(blocks->size(), static_cast<size_t>(first) + count);
+        return vector<uint32_t>(blocks->begin() + first, blocks->begin() + end);
+    }
+
     uint64_t get_file_total_size(uint32_t file_id) const {
-        const vector<uint32_t>* blocks = file_block_map.get(file_id);
-        if (!blocks) return 0;
         uint64_t total_size = 0;
-        for (uint32_t block : *blocks) {
-            const BlockMetadata* m = block_metadata_map.get(block);
-            if (m) total_size += m->data_size;
+        for (uint32_t block : get_file_blocks(file_id)) {
+            BlockMetadata meta;
+            if (read_block_metadata(block, meta)) total_size += meta.data_size;
         }
         return total_size;
     }
 
-    uint32_t get_file_count() const { return file_block_map.size(); }
+    uint32_t get_file_count() const {
+        uint32_t count = 0;
+        for (uint32_t i = 0; i < shard_count; i++) {
+            ShardGuard guard(shards[i]);
+            count += shards[i].file_block_map.size();
+        }
+        return count;
+    }
 
     void print_allocation_map() const {
         cout << "\n=== Block Allocation Map ===\n";
-        vector<uint32_t> keys = file_block_map.keys();
-        for (uint32_t fid : keys) {
-            const vector<uint32_t>* blocks = file_block_map.get(fid);
-            if (!blocks) continue;
-            cout << "File ID " << fid << ": ";
-            for (uint32_t b : *blocks) cout << b << " ";
-            cout << "\n";
+        for (uint32_t i = 0; i < shard_count; i++) {
+            ShardGuard guard(shards[i]);
+            vector<uint32_t> keys = shards[i].file_block_map.keys();
+            for (uint32_t fid : keys) {
+                const vector<uint32_t>* blocks = shards[i].file_block_map.get(fid);
+                if (!blocks) continue;
+                cout << "File ID " << fid << ": ";
+                for (uint32_t b : *blocks) cout << b << " ";
+                cout << "\n";
+            }
         }
         cout << "Free Blocks: " << get_free_blocks() << " / " << total_blocks << "\n";
         cout << "Usage: " << fixed << setprecision(2)
@@ -119,6 +119,11 @@ public:
         return current_size;
     }
 
+    // Bytes held by the bucket table and the entries' list nodes
+    size_t memory_usage() const {
+        return table.capacity() * sizeof(LinkedList<Entry>) + current_size * (sizeof(Entry) + 2 * sizeof(void*));
+    }
+
     void clear() {
         for (auto& bucket : table)
             bucket.clear();
@@ -0,0 +1,235 @@
+#ifndef IO_URING_HPP
+#define IO_URING_HPP
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <cstdint>
+#include <memory>
+
+using namespace std;
+
+// Minimal io_uring over the raw syscalls (no liburing): one submission and
+// one completion ring, identity-mapped SQ array, single-threaded use. Each
+// thread that wants one gets its own via for_thread(); callers submit a group
+// of SQEs and reap exactly that many completions before returning, so rings
+// never carry stray completions between unrelated users.
+class IoUring {
+private:
+    int ring_fd;
+    unsigned entries;
+
+    void* sq_ptr;
+    size_t sq_size;
+    void* cq_ptr;
+    size_t cq_size;
+    io_uring_sqe* sqes;
+    size_t sqes_size;
+
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    io_uring_cqe* cqes;
+
+    unsigned local_tail;   // SQEs handed out but not yet published
+    int registered_file;   // fd registered at fixed index 0, or -1
+    uint64_t registered_generation;
+
+    static int enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+        return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+    }
+
+    static int do_register(int fd, unsigned opcode, const void* arg, unsigned nr_args) {
+        return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+    }
+
+public:
+    static bool enabled;  // container I/O goes through per-thread rings when set
+
+    explicit IoUring(unsigned requested_entries)
+        : ring_fd(-1), entries(0), sq_ptr(MAP_FAILED), sq_size(0), cq_ptr(MAP_FAILED), cq_size(0),
+          sqes(static_cast<io_uring_sqe*>(MAP_FAILED)), sqes_size(0), local_tail(0), registered_file(-1),
+          registered_generation(0) {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        int fd = static_cast<int>(syscall(__NR_io_uring_setup, requested_entries, &params));
+        if (fd < 0) return;
+        ring_fd = fd;
+        entries = params.sq_entries;
+
+        sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single_mmap) sq_size = cq_size = max(sq_size, cq_size);
+
+        sq_ptr = mmap(nullptr, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (sq_ptr == MAP_FAILED) {
+            close_ring();
+            return;
+        }
+        cq_ptr = single_mmap ? sq_ptr
+                             : mmap(nullptr, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cq_ptr == MAP_FAILED) {
+            close_ring();
+            return;
+        }
+        sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = static_cast<io_uring_sqe*>(mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE,
+                                               MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+        if (sqes == MAP_FAILED) {
+            close_ring();
+            return;
+        }
+
+        char* sq = static_cast<char*>(sq_ptr);
+        char* cq = static_cast<char*>(cq_ptr);
+        sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sq_mask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cq_mask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+        unsigned* array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        for (unsigned i = 0; i < params.sq_entries; i++) array[i] = i;
+        local_tail = *sq_tail;
+    }
+
+    ~IoUring() {
+        close_ring();
+    }
+
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+
+    void close_ring() {
+        if (sqes != MAP_FAILED) munmap(sqes, sqes_size);
+        if (cq_ptr != MAP_FAILED && cq_ptr != sq_ptr) munmap(cq_ptr, cq_size);
+        if (sq_ptr != MAP_FAILED) munmap(sq_ptr, sq_size);
+        sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+        sq_ptr = cq_ptr = MAP_FAILED;
+        if (ring_fd >= 0) close(ring_fd);
+        ring_fd = -1;
+    }
+
+    bool ok() const {
+        return ring_fd >= 0;
+    }
+
+    unsigned capacity() const {
+        return entries;
+    }
+
+    // Probed once: io_uring can be missing (old kernel) or switched off
+    // (kernel.io_uring_disabled, seccomp) even where the header exists
+    static bool available() {
+        static int state = -1;
+        if (state < 0) {
+            IoUring probe(4);
+            state = probe.ok() ? 1 : 0;
+        }
+        return state == 1;
+    }
+
+    // Lazily created ring for the calling thread; nullptr if setup failed
+    static IoUring* for_thread() {
+        thread_local unique_ptr<IoUring> ring;
+        thread_local bool tried = false;
+        if (!tried) {
+            tried = true;
+            ring.reset(new IoUring(64));
+            if (!ring->ok()) ring.reset();
+        }
+        return ring.get();
+    }
+
+    io_uring_sqe* get_sqe() {
+        unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+        if (local_tail - head >= entries) return nullptr;
+        io_uring_sqe* sqe = &sqes[local_tail & *sq_mask];
+        memset(sqe, 0, sizeof(*sqe));
+        local_tail++;
+        return sqe;
+    }
+
+    // Publishes everything from get_sqe() and optionally waits for completions.
+    // SQEs an earlier call published but the kernel did not take are offered
+    // again. Returns how many the kernel took.
+    int submit(unsigned wait_nr = 0) {
+        unsigned to_submit = local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+        __atomic_store_n(sq_tail, local_tail, __ATOMIC_RELEASE);
+        int ret;
+        do {
+            ret = enter(ring_fd, to_submit, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0);
+        } while (ret < 0 && errno == EINTR);
+        return ret;
+    }
+
+    // Takes back the SQEs the kernel has not taken yet. There is no SQPOLL
+    // thread, so it only reads the submission ring inside submit().
+    void withdraw() {
+        local_tail = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+        __atomic_store_n(sq_tail, local_tail, __ATOMIC_RELEASE);
+    }
+    
+    // SQEs handed out by get_sqe() that submit() has not published yet
+    unsigned unsubmitted() const {
+        return local_tail - *sq_tail;
+    }
+
+    bool has_completions() const {
+        return *cq_head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    }
+
+    bool peek(io_uring_cqe& out) {
+        unsigned head = *cq_head;
+        if (head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) return false;
+        out = cqes[head & *cq_mask];
+        __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    bool wait(io_uring_cqe& out) {
+        while (!peek(out)) {
+            if (enter(ring_fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) return false;
+        }
+        return true;
+    }
+
+    bool register_buffers(const iovec* iov, unsigned count) {
+        return do_register(ring_fd, IORING_REGISTER_BUFFERS, iov, count) == 0;
+    }
+
+    // Keeps fd at fixed-file index 0. The table pins the file it was given,
+    // so a reopened container that happens to get the same fd number must
+    // carry a new generation to be registered again.
+    bool use_file(int fd, uint64_t generation) {
+        if (registered_file == fd && registered_generation == generation) return true;
+        if (registered_file >= 0) do_register(ring_fd, IORING_UNREGISTER_FILES, nullptr, 0);
+        registered_file = -1;
+        if (do_register(ring_fd, IORING_REGISTER_FILES, &fd, 1) != 0) return false;
+        registered_file = fd;
+        registered_generation = generation;
+        return true;
+    }
+
+    static void prep_rw(io_uring_sqe* sqe, uint8_t op, int fd, const void* addr, unsigned len, uint64_t offset,
+                        uint64_t user_data) {
+        sqe->opcode = op;
+        sqe->fd = fd;
+        sqe->addr = reinterpret_cast<uint64_t>(addr);
+        sqe->len = len;
+        sqe->off = offset;
+        sqe->user_data = user_data;
+    }
+};
+
+#endif
@@ -0,0 +1,165 @@
+#ifndef LZ4_HPP
+#define LZ4_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+using namespace std;
+
+// LZ4 block format (no frame): a run of sequences, each a token byte (high
+// nibble literal count, low nibble match length - 4, 15 meaning more length
+// bytes follow), the literals, a 2-byte little-endian match offset and any
+// extra match length bytes. The last sequence is literals only. Compression
+// is the greedy single-probe hash search of the reference fast mode; any
+// valid LZ4 block decodes.
+
+namespace lz4_detail {
+
+const int MIN_MATCH = 4;
+const int HASH_LOG = 12;
+const size_t LAST_LITERALS = 5;    // the block always ends in this many literals
+const size_t MATCH_SAFE = 12;      // no match may start closer to the end
+const size_t MAX_OFFSET = 65535;
+
+inline uint32_t read32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline uint32_t hash_of(uint32_t sequence) {
+    return (sequence * 2654435761u) >> (32 - HASH_LOG);
+}
+
+// Writes a length's continuation bytes; false if out of room
+inline bool put_length(uint8_t*& op, const uint8_t* end, size_t length) {
+    for (; length >= 255; length -= 255) {
+        if (op >= end) return false;
+        *op++ = 255;
+    }
+    if (op >= end) return false;
+    *op++ = static_cast<uint8_t>(length);
+    return true;
+}
+
+inline bool put_sequence(uint8_t*& op, const uint8_t* end, const uint8_t* literals, size_t literal_count,
+                         size_t offset, size_t match_length) {
+    if (op >= end) return false;
+    uint8_t* token = op++;
+    size_t match_code = match_length ? match_length - MIN_MATCH : 0;
+    *token = static_cast<uint8_t>((literal_count < 15 ? literal_count : 15) << 4);
+    if (literal_count >= 15 && !put_length(op, end, literal_count - 15)) return false;
+    if (static_cast<size_t>(end - op) < literal_count) return false;
+    memcpy(op, literals, literal_count);
+    op += literal_count;
+    if (match_length == 0) return true;
+
+    if (end - op < 2) return false;
+    *op++ = static_cast<uint8_t>(offset);
+    *op++ = static_cast<uint8_t>(offset >> 8);
+    *token |= static_cast<uint8_t>(match_code < 15 ? match_code : 15);
+    return match_code < 15 || put_length(op, end, match_code - 15);
+}
+
+}  // namespace lz4_detail
+
+// Worst-case compressed size of n bytes
+inline size_t lz4_bound(size_t n) {
+    return n + n / 255 + 16;
+}
+
+// Compresses in[0..n) into out; the compressed size, or 0 if it does not
+// fit in capacity
+inline size_t lz4_compress(const char* in, size_t n, char* out, size_t capacity) {
+    using namespace lz4_detail;
+    const uint8_t* src = reinterpret_cast<const uint8_t*>(in);
+    uint8_t* op = reinterpret_cast<uint8_t*>(out);
+    const uint8_t* end = op + capacity;
+
+    uint32_t table[1 << HASH_LOG];
+    memset(table, 0, sizeof(table));  // positions + 1, 0 = empty
+
+    size_t anchor = 0;
+    size_t ip = 0;
+    if (n > MATCH_SAFE) {
+        size_t limit = n - MATCH_SAFE;
+        while (ip < limit) {
+            uint32_t sequence = read32(src + ip);
+            uint32_t h = hash_of(sequence);
+            size_t candidate = table[h];
+            table[h] = static_cast<uint32_t>(ip + 1);
+            if (candidate == 0 || ip - (candidate - 1) > MAX_OFFSET || read32(src + candidate - 1) != sequence) {
+                ip += 1 + ((ip - anchor) >> 6);  // skip faster through data that does not match
+                continue;
+            }
+
+            size_t ref = candidate - 1;
+            while (ip > anchor && ref > 0 && src[ip - 1] == src[ref - 1]) {
+                ip--;
+                ref--;
+            }
+            size_t length = MIN_MATCH;
+            while (ip + length < n - LAST_LITERALS && src[ref + length] == src[ip + length]) length++;
+
+            if (!put_sequence(op, end, src + anchor, ip - anchor, ip - ref, length)) return 0;
+            ip += length;
+            anchor = ip;
+        }
+    }
+    if (!put_sequence(op, end, src + anchor, n - anchor, 0, 0)) return 0;
+    return op - reinterpret_cast<uint8_t*>(out);
+}
+
+// Decompresses in[0..n) into out; false if the block is malformed or would
+// overrun capacity
+inline bool lz4_decompress(const char* in, size_t n, char* out, size_t capacity, size_t& written) {
+    using namespace lz4_detail;
+    const uint8_t* ip = reinterpret_cast<const uint8_t*>(in);
+    const uint8_t* in_end = ip + n;
+    uint8_t* base = reinterpret_cast<uint8_t*>(out);
+    uint8_t* op = base;
+    uint8_t* out_end = base + capacity;
+
+    auto get_length = [&](size_t& length) {
+        uint8_t b;
+        do {
+            if (ip >= in_end) return false;
+            b = *ip++;
+            length += b;
+        } while (b == 255);
+        return true;
+    };
+
+    while (ip < in_end) {
+        uint8_t token = *ip++;
+        size_t literals = token >> 4;
+        if (literals == 15 && !get_length(literals)) return false;
+        if (static_cast<size_t>(in_end - ip) < literals || static_cast<size_t>(out_end - op) < literals) return false;
+        memcpy(op, ip, literals);
+        ip += literals;
+        op += literals;
+        if (ip == in_end) break;
+
+        if (in_end - ip < 2) return false;
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > static_cast<size_t>(op - base)) return false;
+        size_t length = token & 15;
+        if (length == 15 && !get_length(length)) return false;
+        length += MIN_MATCH;
+        if (static_cast<size_t>(out_end - op) < length) return false;
+
+        const uint8_t* match = op - offset;
+        if (offset >= length) {
+            memcpy(op, match, length);
+            op += length;
+        } else {
+            for (size_t i = 0; i < length; i++) *op++ = match[i];  // overlapping: repeats the last offset bytes
+        }
+    }
+    written = op - base;
+    return true;
+}
+
+#endif
@@ -0,0 +1,348 @@
+#ifndef REACTOR_HPP
+#define REACTOR_HPP
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <poll.h>
+#include <chrono>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+#include "IoUring.hpp"
+#include "Task.hpp"
+
+using namespace std;
+
+// Per-worker event loop for request coroutines. A coroutine that would block
+// on a cold container read or a slow client suspends on one of the awaiters
+// below, and the owning worker resumes it from run_once() once the kernel
+// reports completion; in between, the same thread starts and resumes other
+// requests. Coroutines are only resumed on the reactor's own thread and must
+// not hold filesystem locks across a suspension point.
+//
+// With io_uring, reads and sends are SQEs, and everything queued during one
+// loop iteration goes to the kernel in a single io_uring_enter. Without it,
+// socket readiness is awaited through epoll and container reads never
+// suspend (has_ring() is false, so callers read synchronously). Socket waits
+// can carry a timeout: a linked timeout SQE with io_uring, a deadline that
+// run_once() checks under epoll.
+class Reactor {
+public:
+    struct Range {
+        uint64_t offset;
+        size_t length;
+    };
+
+    // Completion state shared between an awaiter and run_once(); it lives in
+    // the suspended coroutine's frame. user_data is its address plus a tag.
+    struct Op {
+        coroutine_handle<> handle;
+        int remaining = 0;
+        int result = 0;
+        bool closed = false;
+        chrono::steady_clock::time_point deadline;  // epoll waits with a timeout
+    };
+
+    enum : uint64_t { TAG_COUNT = 0, TAG_SEND = 1, TAG_CLOSE = 2, TAG_TIMEOUT = 3, TAG_MASK = 3 };
+
+private:
+    unique_ptr<IoUring> ring;
+    int epoll_fd;
+    int active;
+    __kernel_timespec wait_timeout;
+    bool timeout_armed;
+    vector<Op*> timed;  // epoll waits with a deadline
+
+    static Reactor*& current_slot() {
+        thread_local Reactor* reactor = nullptr;
+        return reactor;
+    }
+
+    io_uring_sqe* next_sqe() {
+        io_uring_sqe* sqe = ring->get_sqe();
+        if (!sqe) {
+            ring->submit(0);
+            sqe = ring->get_sqe();
+        }
+        return sqe;
+    }
+
+    static uint64_t tagged(Op* op, uint64_t tag) {
+        return reinterpret_cast<uint64_t>(op) | tag;
+    }
+
+    // Queues a timeout for the SQE just queued, which must carry
+    // IOSQE_IO_LINK; that SQE is cancelled if it is still pending by then.
+    // limit has to live until the op completes.
+    io_uring_sqe* link_timeout(Op* op, __kernel_timespec& limit, int timeout_ms) {
+        limit.tv_sec = timeout_ms / 1000;
+        limit.tv_nsec = static_cast<long long>(timeout_ms % 1000) * 1000000;
+        io_uring_sqe* sqe = next_sqe();
+        IoUring::prep_rw(sqe, IORING_OP_LINK_TIMEOUT, -1, &limit, 1, 0, tagged(op, TAG_TIMEOUT));
+        return sqe;
+    }
+
+    // Returns the op if this completion was its last one
+    static Op* complete(uint64_t user_data, int res) {
+        Op* op = reinterpret_cast<Op*>(user_data & ~TAG_MASK);
+        switch (user_data & TAG_MASK) {
+            case TAG_SEND:
+                if (op->result != -ETIMEDOUT) op->result = res;
+                break;
+            case TAG_CLOSE:
+                op->closed = res >= 0;
+                break;
+            case TAG_TIMEOUT:
+                // -ETIME if it fired (the timed op ends -ECANCELED), else it was cancelled
+                if (res == -ETIME) op->result = -ETIMEDOUT;
+                break;
+            default:
+                if (res < 0 && op->result >= 0) op->result = res;
+                break;
+        }
+        return --op->remaining == 0 ? op : nullptr;
+    }
+
+public:
+    Reactor(bool use_io_uring, int wait_us) : epoll_fd(-1), active(0), timeout_armed(false) {
+        if (use_io_uring) {
+            ring.reset(new IoUring(256));
+            if (!ring->ok()) ring.reset();
+        }
+        if (!ring) epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        wait_timeout.tv_sec = wait_us / 1000000;
+        wait_timeout.tv_nsec = static_cast<long long>(wait_us % 1000000) * 1000;
+    }
+
+    ~Reactor() {
+        if (epoll_fd >= 0) close(epoll_fd);
+    }
+
+    Reactor(const Reactor&) = delete;
+    Reactor& operator=(const Reactor&) = delete;
+
+    static Reactor* current() {
+        return current_slot();
+    }
+
+    // Makes r the calling thread's reactor for the scope's lifetime
+    struct Scope {
+        Reactor* previous;
+        explicit Scope(Reactor* r) : previous(current_slot()) { current_slot() = r; }
+        ~Scope() { current_slot() = previous; }
+    };
+
+    bool has_ring() const {
+        return ring != nullptr;
+    }
+
+    // Coroutines spawned onto this reactor and not yet finished
+    int get_active() const {
+        return active;
+    }
+
+    void started() {
+        active++;
+    }
+
+    void finished() {
+        active--;
+    }
+
+    // Reads every range into scratch (contents are thrown away); used to pull
+    // cold container blocks into the page cache without holding locks.
+    // scratch must hold the largest range. Resumes with 0 or the first error.
+    struct ReadAwaiter {
+        Reactor* reactor;
+        int fd;
+        char* scratch;
+        const vector<Range>* ranges;
+        Op op;
+
+        bool await_ready() const {
+            return ranges->empty();
+        }
+
+        void await_suspend(coroutine_handle<> h) {
+            op.handle = h;
+            op.remaining = static_cast<int>(ranges->size());
+            for (const Range& r : *ranges) {
+                IoUring::prep_rw(reactor->next_sqe(), IORING_OP_READ, fd, scratch, static_cast<unsigned>(r.length),
+                                 r.offset, tagged(&op, TAG_COUNT));
+            }
+        }
+
+        int await_resume() const {
+            return op.result;
+        }
+    };
+
+    ReadAwaiter read_ranges(int fd, char* scratch, const vector<Range>& ranges) {
+        return ReadAwaiter{this, fd, scratch, &ranges, Op()};
+    }
+
+    struct SendResult {
+        int sent;     // bytes sent or -errno
+        bool closed;  // false if the close was cancelled by a short send
+    };
+
+    // io_uring only: SEND linked to CLOSE. A short send cancels the close
+    // and leaves the rest of the data and the socket to the caller, as does
+    // a send cancelled for running past timeout_ms.
+    struct SendCloseAwaiter {
+        Reactor* reactor;
+        int fd;
+        const char* data;
+        size_t length;
+        int timeout_ms;
+        __kernel_timespec limit;
+        Op op;
+
+        bool await_ready() const {
+            return false;
+        }
+
+        void await_suspend(coroutine_handle<> h) {
+            op.handle = h;
+            op.remaining = 3;
+            io_uring_sqe* sqe = reactor->next_sqe();
+            IoUring::prep_rw(sqe, IORING_OP_SEND, fd, data, static_cast<unsigned>(length), 0, tagged(&op, TAG_SEND));
+            sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+            sqe->flags |= IOSQE_IO_LINK;
+            reactor->link_timeout(&op, limit, timeout_ms)->flags |= IOSQE_IO_LINK;
+            IoUring::prep_rw(reactor->next_sqe(), IORING_OP_CLOSE, fd, nullptr, 0, 0, tagged(&op, TAG_CLOSE));
+        }
+
+        SendResult await_resume() const {
+            return SendResult{op.result, op.closed};
+        }
+    };
+
+    SendCloseAwaiter send_and_close(int fd, const char* data, size_t length, int timeout_ms) {
+        return SendCloseAwaiter{this, fd, data, length, timeout_ms, {}, Op()};
+    }
+
+    // Resumes once fd is ready for the given poll events (or has failed);
+    // 0 or -errno, -ETIMEDOUT if timeout_ms (when not 0) passed first
+    struct PollAwaiter {
+        Reactor* reactor;
+        int fd;
+        short events;
+        int timeout_ms;
+        __kernel_timespec limit;
+        Op op;
+
+        bool await_ready() const {
+            return false;
+        }
+
+        bool await_suspend(coroutine_handle<> h) {
+            op.handle = h;
+            op.remaining = 1;
+            if (reactor->ring) {
+                io_uring_sqe* sqe = reactor->next_sqe();
+                IoUring::prep_rw(sqe, IORING_OP_POLL_ADD, fd, nullptr, 0, 0, tagged(&op, TAG_COUNT));
+                sqe->poll32_events = events;
+                if (timeout_ms > 0) {
+                    sqe->flags |= IOSQE_IO_LINK;
+                    reactor->link_timeout(&op, limit, timeout_ms);
+                    op.remaining = 2;
+                }
+                return true;
+            }
+            epoll_event ev;
+            ev.events = EPOLLONESHOT;
+            if (events & POLLIN) ev.events |= EPOLLIN | EPOLLRDHUP;
+            if (events & POLLOUT) ev.events |= EPOLLOUT;
+            ev.data.ptr = &op;
+            if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+                op.result = -errno;
+                return false;
+            }
+            if (timeout_ms > 0) {
+                op.deadline = chrono::steady_clock::now() + chrono::milliseconds(timeout_ms);
+                reactor->timed.push_back(&op);
+            }
+            return true;
+        }
+
+        int await_resume() {
+            if (!reactor->ring) {
+                epoll_ctl(reactor->epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+                if (timeout_ms > 0) erase(reactor->timed, &op);
+            }
+            return op.result < 0 ? op.result : 0;
+        }
+    };
+
+    PollAwaiter writable(int fd, int timeout_ms = 0) {
+        return PollAwaiter{this, fd, POLLOUT, timeout_ms, {}, Op()};
+    }
+
+    PollAwaiter readable(int fd, int timeout_ms = 0) {
+        return PollAwaiter{this, fd, POLLIN, timeout_ms, {}, Op()};
+    }
+
+    // Submits queued work and resumes whatever has completed. With block set,
+    // waits up to the reactor's wait time for at least one completion.
+    void run_once(bool block) {
+        vector<Op*> ready;
+        if (ring) {
+            if (ring->has_completions()) block = false;
+            if (block && !timeout_armed) {
+                // Completes on the first other CQE or when the wait runs out
+                io_uring_sqe* sqe = next_sqe();
+                IoUring::prep_rw(sqe, IORING_OP_TIMEOUT, -1, &wait_timeout, 1, 1, 0);
+                timeout_armed = true;
+            }
+            if (block || ring->unsubmitted() > 0) ring->submit(block ? 1 : 0);
+            io_uring_cqe cqe;
+            while (ring->peek(cqe)) {
+                if (cqe.user_data == 0) {
+                    timeout_armed = false;
+                    continue;
+                }
+                Op* op = complete(cqe.user_data, cqe.res);
+                if (op) ready.push_back(op);
+            }
+        } else {
+            epoll_event events[64];
+            int timeout_ms = block ? static_cast<int>((wait_timeout.tv_nsec + 999999) / 1000000 + wait_timeout.tv_sec * 1000) : 0;
+            int n = epoll_wait(epoll_fd, events, 64, timeout_ms);
+            for (int i = 0; i < n; i++) {
+                Op* op = static_cast<Op*>(events[i].data.ptr);
+                if (events[i].events & (EPOLLERR | EPOLLHUP)) op->result = -EPIPE;
+                op->remaining = 0;
+                ready.push_back(op);
+            }
+            auto now = chrono::steady_clock::now();
+            for (Op* op : timed) {
+                if (op->remaining == 0 || now < op->deadline) continue;
+                op->result = -ETIMEDOUT;
+                op->remaining = 0;
+                ready.push_back(op);
+            }
+        }
+        for (Op* op : ready) op->handle.resume();
+    }
+};
+
+// Runs a task to completion on the calling thread for the blocking C API.
+// The thread's reactor is hidden while it runs, so every awaiter on the way
+// takes its synchronous path and the task never actually suspends.
+template<typename T>
+T sync_wait(task<T> t) {
+    Reactor::Scope no_reactor(nullptr);
+    t.get_handle().resume();
+    if (!t.get_handle().done()) abort();
+    return t.await_resume();
+}
+
+inline void sync_wait(task<void> t) {
+    Reactor::Scope no_reactor(nullptr);
+    t.get_handle().resume();
+    if (!t.get_handle().done()) abort();
+    t.await_resume();
+}
+
+#endif
@@ -0,0 +1,162 @@
+#ifndef SESSION_SCHEDULER_HPP
+#define SESSION_SCHEDULER_HPP
+
+#include <string>
+#include <deque>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <pthread.h>
+#include "WorkStealingPool.hpp"
+
+// Orders work per lane (one lane per session) without ordering lanes against
+// each other. Each lane with pending work has exactly one turn token in the
+// worker pool; a worker that draws the token runs that lane's oldest item and,
+// after finish(), puts the token back at the tail if the lane still has work.
+// So one lane never runs two items at once, different lanes run in parallel,
+// and a lane with a deep backlog gets one item per round like everyone else.
+// A turn token is queued under the priority class of the lane's oldest item.
+template<typename T>
+class SessionScheduler {
+private:
+    struct Pending {
+        T item;
+        int cls;
+    };
+
+    struct Lane {
+        std::deque<Pending> pending;
+        bool running;
+    };
+
+    WorkStealingPool<std::string> pool;
+    bool affinity;
+
+    pthread_mutex_t lock;
+    pthread_cond_t has_room;
+    std::unordered_map<std::string, Lane> lanes;
+    size_t queued;
+    size_t capacity;
+    uint64_t next_anonymous;
+    bool stopped;
+
+    void schedule(const std::string& lane, int cls) {
+        size_t key = affinity ? std::hash<std::string>()(lane) : WorkStealingPool<std::string>::NO_AFFINITY;
+        std::string token = lane;
+        pool.submit(std::move(token), key, cls);
+    }
+
+public:
+    struct Turn {
+        std::string lane;
+        T item;
+        int cls;
+    };
+
+private:
+    // Turns the lane tokens a worker drew into the lanes' oldest items
+    std::vector<Turn> claim(std::vector<std::string> tokens) {
+        std::vector<Turn> turns;
+        turns.reserve(tokens.size());
+
+        pthread_mutex_lock(&lock);
+        for (auto& lane : tokens) {
+            Lane& l = lanes[lane];
+            Pending& head = l.pending.front();
+            turns.push_back(Turn{lane, std::move(head.item), head.cls});
+            l.pending.pop_front();
+        }
+        queued -= turns.size();
+        pthread_mutex_unlock(&lock);
+        if (!turns.empty()) pthread_cond_broadcast(&has_room);
+        return turns;
+    }
+
+public:
+    // The pool never holds more tokens than there are queued items, so sizing
+    // it to the same capacity means handing a token back never blocks a worker
+    SessionScheduler(int workers, int cap, bool session_affinity,
+                     const std::vector<int>& class_weights = std::vector<int>(1, 1))
+        : pool(workers, cap > 1 ? cap : 1, class_weights), affinity(session_affinity),
+          queued(0), capacity(cap > 1 ? cap : 1), next_anonymous(0), stopped(false) {
+        pthread_mutex_init(&lock, nullptr);
+        pthread_cond_init(&has_room, nullptr);
+    }
+
+    ~SessionScheduler() {
+        pthread_mutex_destroy(&lock);
+        pthread_cond_destroy(&has_room);
+    }
+
+    SessionScheduler(const SessionScheduler&) = delete;
+    SessionScheduler& operator=(const SessionScheduler&) = delete;
+
+    // Blocks while capacity items are already waiting. An empty lane name puts
+    // the item in a lane of its own, unordered against everything else.
+    void submit(const std::string& lane_name, T&& item, int cls = 0) {
+        pthread_mutex_lock(&lock);
+        while (queued >= capacity && !stopped) {
+            pthread_cond_wait(&has_room, &lock);
+        }
+        std::string lane = lane_name.empty() ? "#" + std::to_string(next_anonymous++) : lane_name;
+        auto it = lanes.find(lane);
+        if (it == lanes.end()) it = lanes.emplace(lane, Lane{std::deque<Pending>(), false}).first;
+        it->second.pending.push_back(Pending{std::move(item), cls});
+        queued++;
+        bool needs_turn = !it->second.running;
+        it->second.running = true;
+        pthread_mutex_unlock(&lock);
+
+        if (needs_turn) schedule(lane, cls);
+    }
+
+    // Blocks until the worker has turns to run; empty once stopped and drained
+    std::vector<Turn> take(int worker, size_t max_n) {
+        return claim(pool.take(worker, max_n));
+    }
+
+    // Non-blocking take(); empty when nothing is runnable right now
+    std::vector<Turn> try_take(int worker, size_t max_n) {
+        return claim(pool.try_take(worker, max_n));
+    }
+
+    // Called once the item from take() is done; lets the lane's next item run
+    void finish(const std::string& lane) {
+        pthread_mutex_lock(&lock);
+        auto it = lanes.find(lane);
+        bool more = !it->second.pending.empty();
+        int cls = more ? it->second.pending.front().cls : 0;
+        if (!more) lanes.erase(it);
+        pthread_mutex_unlock(&lock);
+
+        if (more) schedule(lane, cls);
+    }
+
+    void stop() {
+        pthread_mutex_lock(&lock);
+        stopped = true;
+        pthread_mutex_unlock(&lock);
+        pthread_cond_broadcast(&has_room);
+        pool.stop();
+    }
+
+    int get_size() {
+        pthread_mutex_lock(&lock);
+        size_t n = queued;
+        pthread_mutex_unlock(&lock);
+        return static_cast<int>(n);
+    }
+
+    size_t get_lane_count() {
+        pthread_mutex_lock(&lock);
+        size_t n = lanes.size();
+        pthread_mutex_unlock(&lock);
+        return n;
+    }
+
+    uint64_t get_steal_count() {
+        return pool.get_steal_count();
+    }
+};
+
+#endif
@@ -10,45 +10,114 @@
 #include <algorithm>
 #include <random>
 #include <iostream>
+#include <atomic>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
 #include "IndexGenerator.hpp"
 #include "AVL.hpp"
 #include "UserSystem.hpp"
 #include "FreeSpaceManager.hpp"
+#include "EpochManager.hpp"
 #include "FileSystem.hpp"
 using namespace std;
 
 struct OMNIInstance;
 
+enum class ChangeKind { FILE_CREATED, FILE_EDITED, FILE_DELETED, FILE_RENAMED, DIR_CREATED, DIR_DELETED };
+
+// What a successful mutation needs to be undone
+struct Change {
+    ChangeKind kind;
+    string path;
+    string old_path;       // FILE_RENAMED: where the node came from
+    uint64_t offset;       // FILE_EDITED
+    string data;           // FILE_EDITED: bytes overwritten; FILE_DELETED: the whole file
+    string owner;          // *_DELETED
+    uint32_t permissions;  // *_DELETED
+    uint64_t old_size;     // FILE_EDITED: length before the edit
+};
+
+// Undo records for one atomic batch, newest last (see change_log_begin)
+struct ChangeLog {
+    vector<Change> changes;
+};
+
 struct Session {
     string session_id;
     UserInfo* user;
     OMNIInstance* instance;
     uint64_t login_time;
-    uint64_t last_activity;
-    uint32_t operations_count;
+    atomic<uint64_t> last_activity;
+    atomic<uint32_t> operations_count;
+    ChangeLog* change_log;  // set while an atomic batch runs on this session
     
     Session(const string& id, UserInfo* u, OMNIInstance* inst) 
-        : session_id(id), user(u), instance(inst), operations_count(0) {
+        : session_id(id), user(u), instance(inst), operations_count(0), change_log(nullptr) {
         login_time = time(nullptr);
         last_activity = login_time;
     }
+    
+    ~Session() {
+        delete change_log;
+    }
+};
+
+// Scoped holders for a single rwlock. File and directory operations take
+// OMNIInstance::fs_lock shared and serialize on the per-node locks instead
+// (see PathLocks); user and session management takes it exclusive.
+struct SharedLock {
+    pthread_rwlock_t* lock;
+    SharedLock(pthread_rwlock_t* l) : lock(l) { pthread_rwlock_rdlock(lock); }
+    ~SharedLock() { pthread_rwlock_unlock(lock); }
+};
+
+struct ExclusiveLock {
+    pthread_rwlock_t* lock;
+    ExclusiveLock(pthread_rwlock_t* l) : lock(l) { pthread_rwlock_wrlock(lock); }
+    ~ExclusiveLock() { pthread_rwlock_unlock(lock); }
+};
+
+// Work done by the chunk codec (see store_chunk) since startup, for get_stats.
+// Nothing is taken off when a chunk is overwritten or its file deleted.
+struct CodecCounters {
+    atomic<uint64_t> stored_raw{0};     // bytes of chunks stored compressed...
+    atomic<uint64_t> stored_packed{0};  // ...and what they were stored as
+    atomic<uint64_t> compressed_bytes{0};
+    atomic<uint64_t> compress_ns{0};
+    atomic<uint64_t> decompressed_bytes{0};
+    atomic<uint64_t> decompress_ns{0};
 };
 
 struct OMNIInstance {
     OMNIHeader header;
     fstream omni_file;
     string omni_path;
+    int data_fd;  // content blocks go through pread/pwrite so readers never share a file cursor
+    uint64_t io_generation;  // tells per-thread io_uring file tables this data_fd apart from older ones
+    
+    pthread_rwlock_t fs_lock;
     
     UserSystem user_system;
     FileSystem file_system;
     FreeSpaceManager free_space;
+    CodecCounters codec;
     
     vector<Session*> sessions;
     
     bool file_open;
     uint32_t admin_index;
     
-    OMNIInstance() : file_open(false), admin_index(0) {}
+    OMNIInstance() : data_fd(-1), file_open(false), admin_index(0) {
+        static atomic<uint64_t> generations(0);
+        io_generation = ++generations;
+        pthread_rwlockattr_t attr;
+        pthread_rwlockattr_init(&attr);
+        pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+        pthread_rwlock_init(&fs_lock, &attr);
+        pthread_rwlockattr_destroy(&attr);
+    }
     
     ~OMNIInstance() {
         for (auto* sess : sessions) {
@@ -57,6 +126,56 @@ struct OMNIInstance {
         if (file_open && omni_file.is_open()) {
             omni_file.close();
         }
+        if (data_fd >= 0) {
+            close(data_fd);
+        }
+        pthread_rwlock_destroy(&fs_lock);
+    }
+    
+    // Ranges never written read back as zeros, like a preallocated container
+    bool read_at(uint64_t offset, char* buffer, size_t length) const {
+        size_t done = 0;
+        while (done < length) {
+            ssize_t n = pread(data_fd, buffer + done, length - done, offset + done);
+            if (n < 0) return false;
+            if (n == 0) {
+                memset(buffer + done, 0, length - done);
+                break;
+            }
+            done += n;
+        }
+        return true;
+    }
+    
+    // read_at that never waits on the disk: 1 when the whole range was served
+    // from the page cache, 0 when some of it was not cached, -1 on error
+    int read_at_nowait(uint64_t offset, char* buffer, size_t length) const {
+        size_t done = 0;
+        while (done < length) {
+            iovec iov = {buffer + done, length - done};
+            ssize_t n = preadv2(data_fd, &iov, 1, offset + done, RWF_NOWAIT);
+            if (n < 0) {
+                if (errno == EAGAIN) return 0;
+                if (errno == EOPNOTSUPP) return read_at(offset + done, buffer + done, length - done) ? 1 : -1;
+                return -1;
+            }
+            if (n == 0) {
+                memset(buffer + done, 0, length - done);
+                break;
+            }
+            done += n;
+        }
+        return 1;
+    }
+    
+    bool write_at(uint64_t offset, const char* buffer, size_t length) {
+        size_t done = 0;
+        while (done < length) {
+            ssize_t n = pwrite(data_fd, buffer + done, length - done, offset + done);
+            if (n <= 0) return false;
+            done += n;
+        }
+        return true;
     }
     
     uint64_t get_data_offset() const {
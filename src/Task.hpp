@@ -0,0 +1,136 @@
+#ifndef TASK_HPP
+#define TASK_HPP
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+using namespace std;
+
+template<typename T>
+class task;
+
+namespace task_detail {
+
+// When a task finishes it hands control straight to whoever awaited it
+// (symmetric transfer), so deep co_await chains do not grow the stack
+struct FinalAwaiter {
+    bool await_ready() noexcept { return false; }
+
+    template<typename Promise>
+    coroutine_handle<> await_suspend(coroutine_handle<Promise> finished) noexcept {
+        coroutine_handle<> next = finished.promise().continuation;
+        return next ? next : noop_coroutine();
+    }
+
+    void await_resume() noexcept {}
+};
+
+struct PromiseBase {
+    coroutine_handle<> continuation;
+    exception_ptr error;
+
+    suspend_always initial_suspend() noexcept { return {}; }
+    FinalAwaiter final_suspend() noexcept { return {}; }
+    void unhandled_exception() { error = current_exception(); }
+};
+
+}
+
+// Lazily started coroutine producing a T. Nothing runs until the task is
+// co_awaited (or driven by sync_wait in Reactor.hpp); the awaiter is resumed
+// with the result once the body reaches co_return.
+template<typename T>
+class task {
+public:
+    struct promise_type : task_detail::PromiseBase {
+        optional<T> value;
+
+        task get_return_object() {
+            return task(coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        template<typename U>
+        void return_value(U&& v) {
+            value.emplace(std::forward<U>(v));
+        }
+    };
+
+    task(task&& other) noexcept : handle(exchange(other.handle, nullptr)) {}
+    task(const task&) = delete;
+    task& operator=(const task&) = delete;
+
+    ~task() {
+        if (handle) handle.destroy();
+    }
+
+    bool await_ready() const noexcept { return false; }
+
+    coroutine_handle<> await_suspend(coroutine_handle<> awaiting) noexcept {
+        handle.promise().continuation = awaiting;
+        return handle;
+    }
+
+    T await_resume() {
+        if (handle.promise().error) rethrow_exception(handle.promise().error);
+        return std::move(*handle.promise().value);
+    }
+
+    coroutine_handle<promise_type> get_handle() const { return handle; }
+
+private:
+    explicit task(coroutine_handle<promise_type> h) : handle(h) {}
+    coroutine_handle<promise_type> handle;
+};
+
+template<>
+class task<void> {
+public:
+    struct promise_type : task_detail::PromiseBase {
+        task get_return_object() {
+            return task(coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        void return_void() {}
+    };
+
+    task(task&& other) noexcept : handle(exchange(other.handle, nullptr)) {}
+    task(const task&) = delete;
+    task& operator=(const task&) = delete;
+
+    ~task() {
+        if (handle) handle.destroy();
+    }
+
+    bool await_ready() const noexcept { return false; }
+
+    coroutine_handle<> await_suspend(coroutine_handle<> awaiting) noexcept {
+        handle.promise().continuation = awaiting;
+        return handle;
+    }
+
+    void await_resume() {
+        if (handle.promise().error) rethrow_exception(handle.promise().error);
+    }
+
+    coroutine_handle<promise_type> get_handle() const { return handle; }
+
+private:
+    explicit task(coroutine_handle<promise_type> h) : handle(h) {}
+    coroutine_handle<promise_type> handle;
+};
+
+// Fire-and-forget coroutine: starts immediately and frees itself when done.
+// Whoever spawns one is responsible for knowing when it has finished.
+struct detached {
+    struct promise_type {
+        detached get_return_object() { return {}; }
+        suspend_never initial_suspend() noexcept { return {}; }
+        suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { terminate(); }
+    };
+};
+
+#endif
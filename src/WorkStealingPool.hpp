@@ -0,0 +1,206 @@
+#ifndef WORK_STEALING_POOL_HPP
+#define WORK_STEALING_POOL_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include "BoundedBlockingQueue.hpp"
+
+// One bounded ring per worker and priority class. Submitters pick a worker
+// (by affinity key or round-robin) and push to its ring for the item's class;
+// a worker drains its own rings first and only when they are all empty steals
+// up to half of another worker's backlog. Idle workers all park on one futex
+// word, so work landing on any ring can wake whichever worker is free rather
+// than waiting for its owner.
+//
+// Classes are served by stride scheduling: each worker keeps a virtual pass
+// per class that advances by STRIDE / weight per item taken, and always takes
+// from the non-empty class with the lowest pass. A class with weight 8 gets
+// eight items for every one of a weight-1 class while both have work, and a
+// class that was idle resumes at the current pass instead of bursting.
+template<typename T>
+class WorkStealingPool {
+private:
+    static const uint64_t STRIDE = 1 << 20;
+
+    struct alignas(64) WorkerState {
+        std::vector<uint64_t> pass;
+        uint64_t virtual_time = 0;
+    };
+
+    int class_count;
+    std::vector<uint64_t> strides;
+    std::vector<std::vector<BoundedBlockingQueue<T>*>> queues;  // [worker][class]
+    std::vector<WorkerState> state;
+
+    alignas(64) std::atomic<uint32_t> next_queue;
+    alignas(64) std::atomic<uint32_t> work_seq;
+    std::atomic<uint32_t> idle_workers;
+    std::atomic<bool> stopped;
+    std::atomic<uint64_t> steals;
+
+    void work_added() {
+        work_seq.fetch_add(1);
+        if (idle_workers.load() > 0) futex_wake(&work_seq, 1);
+    }
+
+    // Lowest-pass class of source that has something queued, or -1
+    int pick_class(WorkerState& ws, std::vector<BoundedBlockingQueue<T>*>& source) {
+        int best = -1;
+        uint64_t best_pass = 0;
+        for (int c = 0; c < class_count; c++) {
+            if (source[c]->get_size() <= 0) continue;
+            uint64_t p = ws.pass[c] > ws.virtual_time ? ws.pass[c] : ws.virtual_time;
+            if (best < 0 || p < best_pass) {
+                best = c;
+                best_pass = p;
+            }
+        }
+        return best;
+    }
+
+    void charge(WorkerState& ws, int c, size_t taken) {
+        uint64_t p = ws.pass[c] > ws.virtual_time ? ws.pass[c] : ws.virtual_time;
+        ws.virtual_time = p;
+        ws.pass[c] = p + strides[c] * taken;
+    }
+
+    size_t take_own(int worker, std::vector<T>& out, size_t max_n) {
+        WorkerState& ws = state[worker];
+        size_t taken = 0;
+        while (taken < max_n) {
+            int c = pick_class(ws, queues[worker]);
+            if (c < 0) break;
+            if (queues[worker][c]->try_dequeue_bulk(out, 1) == 0) break;  // stolen or not yet published
+            charge(ws, c, 1);
+            taken++;
+        }
+        return taken;
+    }
+
+    size_t steal(int thief, std::vector<T>& out, size_t max_n) {
+        WorkerState& ws = state[thief];
+        size_t n = queues.size();
+        for (size_t k = 1; k < n; k++) {
+            std::vector<BoundedBlockingQueue<T>*>& victim = queues[(thief + k) % n];
+            int c = pick_class(ws, victim);
+            if (c < 0) continue;
+            int backlog = victim[c]->get_size();
+            size_t want = static_cast<size_t>(backlog + 1) / 2;
+            if (want > max_n) want = max_n;
+            size_t taken = victim[c]->try_dequeue_bulk(out, want);
+            if (taken > 0) {
+                charge(ws, c, taken);
+                steals.fetch_add(1, std::memory_order_relaxed);
+                return taken;
+            }
+        }
+        return 0;
+    }
+
+public:
+    static const size_t NO_AFFINITY = SIZE_MAX;
+
+    // capacity is the total across all workers; each class gets that much
+    // room of its own so a flood in one class never blocks another.
+    // weights has one entry per class (higher = larger share).
+    WorkStealingPool(int workers, int capacity, const std::vector<int>& weights = std::vector<int>(1, 1))
+        : class_count(weights.empty() ? 1 : static_cast<int>(weights.size())),
+          next_queue(0), work_seq(0), idle_workers(0), stopped(false), steals(0) {
+        if (workers < 1) workers = 1;
+        for (int c = 0; c < class_count; c++) {
+            int w = weights.empty() || weights[c] < 1 ? 1 : weights[c];
+            strides.push_back(STRIDE / w);
+        }
+        int per_worker = (capacity + workers - 1) / workers;
+        queues.resize(workers);
+        state.resize(workers);
+        for (int i = 0; i < workers; i++) {
+            for (int c = 0; c < class_count; c++) {
+                queues[i].push_back(new BoundedBlockingQueue<T>(per_worker));
+            }
+            state[i].pass.assign(class_count, 0);
+        }
+    }
+
+    ~WorkStealingPool() {
+        for (auto& rings : queues) {
+            for (auto* q : rings) delete q;
+        }
+    }
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    // Items with the same key go to the same worker while it keeps up; if its
+    // ring is full the item spills to the next worker with room, and only when
+    // every ring of the class is full does the caller block on the preferred one
+    void submit(T&& item, size_t key = NO_AFFINITY, int cls = 0) {
+        if (cls < 0 || cls >= class_count) cls = class_count - 1;
+        size_t n = queues.size();
+        size_t home = key == NO_AFFINITY ? next_queue.fetch_add(1, std::memory_order_relaxed) % n : key % n;
+        for (size_t k = 0; k < n; k++) {
+            if (queues[(home + k) % n][cls]->try_enqueue(std::move(item))) {
+                work_added();
+                return;
+            }
+        }
+        queues[home][cls]->enqueue(std::move(item));
+        work_added();
+    }
+
+    // Blocks until this worker has something to run: its own rings first, then
+    // stolen work. Returns an empty batch once stop() was called and nothing
+    // is left anywhere. Only the owning worker may call take() with its index.
+    std::vector<T> take(int worker, size_t max_n) {
+        std::vector<T> batch;
+        if (max_n == 0) return batch;
+        for (;;) {
+            uint32_t seen = work_seq.load();
+            if (take_own(worker, batch, max_n) > 0) return batch;
+            if (steal(worker, batch, max_n) > 0) return batch;
+            if (stopped.load()) return batch;
+            idle_workers.fetch_add(1);
+            futex_wait(&work_seq, seen);
+            idle_workers.fetch_sub(1);
+        }
+    }
+
+    // Same as take() but never parks; for workers that still have other
+    // things to do when nothing is queued
+    std::vector<T> try_take(int worker, size_t max_n) {
+        std::vector<T> batch;
+        if (max_n == 0) return batch;
+        if (take_own(worker, batch, max_n) == 0) steal(worker, batch, max_n);
+        return batch;
+    }
+
+    void stop() {
+        stopped.store(true);
+        work_seq.fetch_add(1);
+        futex_wake(&work_seq, INT_MAX);
+    }
+
+    int get_worker_count() {
+        return static_cast<int>(queues.size());
+    }
+
+    int get_class_count() {
+        return class_count;
+    }
+
+    uint64_t get_steal_count() {
+        return steals.load(std::memory_order_relaxed);
+    }
+
+    int get_size() {
+        int total = 0;
+        for (auto& rings : queues) {
+            for (auto* q : rings) total += q->get_size();
+        }
+        return total;
+    }
+};
+
+#endif
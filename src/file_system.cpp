@@ -7,27 +7,44 @@
 #include <algorithm>
 #include <random>
 #include <iostream>
+#include <functional>
+#include <map>
+#include <string_view>
+#include <chrono>
+#include <memory>
 #include "IndexGenerator.hpp"
 #include "AVL.hpp"
 #include "UserSystem.hpp"
 #include "FreeSpaceManager.hpp"
+#include "EpochManager.hpp"
+#include "IoUring.hpp"
+#include "Reactor.hpp"
 #include "FileSystem.hpp"
 #include "Session_Instance.hpp"
+#include "Lz4.hpp"
 
 using namespace std;
 
 mt19937 IndexGenerator::rng;
 uniform_int_distribution<uint32_t> IndexGenerator::dist(100000, 999999);
 
-bool parse_config(OMNIHeader& header, const string& config_path) {
+atomic<uint64_t> EpochManager::global_epoch(1);
+atomic<uint32_t> EpochManager::overflow_readers(0);
+EpochManager::Slot EpochManager::slots[MAX_EPOCH_THREADS];
+pthread_mutex_t EpochManager::retire_lock = PTHREAD_MUTEX_INITIALIZER;
+vector<EpochManager::Retired> EpochManager::retired;
+thread_local EpochManager::SlotHandle EpochManager::handle;
+
+bool IoUring::enabled = false;
+
+// Calls entry(section, key, value) for every "key = value" line; section
+// names are lowercased and surrounding whitespace/quotes are trimmed
+bool read_config_entries(const string& config_path,
+                         const function<void(const string&, const string&, const string&)>& entry) {
     ifstream file(config_path);
     if (!file.is_open()) return false;
 
     string line, section;
-    memset(&header, 0, sizeof(OMNIHeader));
-    memcpy(header.magic, "OMNIFS01", 8);
-    header.format_version = 0x00010000;
-
     while (getline(file, line)) {
         line.erase(0, line.find_first_not_of(" \t\r\n"));
         line.erase(line.find_last_not_of(" \t\r\n") + 1);
@@ -52,11 +69,25 @@ bool parse_config(OMNIHeader& header, const string& config_path) {
         trim(key);
         trim(value);
 
+        entry(section, key, value);
+    }
+    return true;
+}
+
+bool parse_config(OMNIHeader& header, const string& config_path) {
+    memset(&header, 0, sizeof(OMNIHeader));
+    memcpy(header.magic, "OMNIFS01", 8);
+    header.format_version = 0x00010000;
+
+    bool found = read_config_entries(config_path, [&](const string& section, const string& key, const string& value) {
         if (section == "filesystem") {
             if (key == "total_size") header.total_size = stoull(value);
             else if (key == "header_size") header.header_size = stoull(value);
             else if (key == "block_size") header.block_size = stoul(value);
             else if (key == "max_users") header.max_users = stoul(value);
+            else if (key == "user_quota") header.user_quota = stoull(value);
+            else if (key == "dedup") header.dedup = (value == "true" || value == "1");
+            else if (key == "compression") header.compression = (value == "true" || value == "1");
         }
         else if (section == "security") {
             if (key == "max_users") header.max_users = stoul(value);
@@ -67,7 +98,8 @@ bool parse_config(OMNIHeader& header, const string& config_path) {
             else if (key == "require_auth")
                 header.require_auth = (value == "true" || value == "1");
         }
-    }
+    });
+    if (!found) return false;
 
     time_t t = time(nullptr);
     tm* tm_info = localtime(&t);
@@ -174,6 +206,12 @@ int fs_init(void** instance, const char* omni_path, const char* config_path) {
         inst->omni_file.flush();
     }
     
+    inst->data_fd = open(omni_path, O_RDWR);
+    if (inst->data_fd < 0) {
+        delete inst;
+        return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+    }
+    
     inst->file_open = true;
     
     uint64_t data_size = inst->header.total_size - inst->get_data_offset();
@@ -201,6 +239,7 @@ int user_login(void** session, void* instance, uint32_t user_index, const char*
     }
     
     OMNIInstance* inst = static_cast<OMNIInstance*>(instance);
+    ExclusiveLock lock(&inst->fs_lock);
     UserInfo* user = inst->user_system.find_user_by_index(user_index);
     
     if (!user || !user->is_active) {
@@ -232,6 +271,7 @@ int user_logout(void* session) {
     
     Session* sess = static_cast<Session*>(session);
     OMNIInstance* inst = sess->instance;
+    ExclusiveLock lock(&inst->fs_lock);
     
     auto it = find(inst->sessions.begin(), inst->sessions.end(), sess);
     if (it != inst->sessions.end()) {
@@ -254,6 +294,7 @@ int user_create(void* session, const char* username, const char* password, UserR
     }
     
     OMNIInstance* inst = sess->instance;
+    ExclusiveLock lock(&inst->fs_lock);
     
     uint32_t new_index = IndexGenerator::generate();
     while (inst->user_system.find_user_by_index(new_index) != nullptr) {
@@ -303,6 +344,7 @@ int user_delete(void* session, uint32_t user_index) {
     }
     
     OMNIInstance* inst = sess->instance;
+    ExclusiveLock lock(&inst->fs_lock);
     UserInfo* user = inst->user_system.find_user_by_index(user_index);
     
     if (!user) {
@@ -330,6 +372,7 @@ int user_list(void* session, UserInfo** users, int* count) {
     }
     
     OMNIInstance* inst = sess->instance;
+    SharedLock lock(&inst->fs_lock);
     
     // Get all active users - O(n)
     inst->user_system.get_all_users(users, count);
@@ -346,6 +389,7 @@ int get_session_info(void* session, SessionInfo* info) {
     }
     
     Session* sess = static_cast<Session*>(session);
+    SharedLock lock(&sess->instance->fs_lock);
     
     strncpy(info->session_id, sess->session_id.c_str(), sizeof(info->session_id) - 1);
     info->session_id[sizeof(info->session_id) - 1] = '\0';
@@ -360,41 +404,503 @@ int get_session_info(void* session, SessionInfo* info) {
     return static_cast<int>(OFSErrorCodes::SUCCESS);
 }
 
-int file_create(void* session, const char* path, const char* data, size_t size) {
-    if (!session || !path) {
-        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+// A file's start_block is its allocation id; its data lives in the blocks
+// the allocator recorded for that id, which need not be contiguous.
+struct DataChunk {
+    uint64_t offset;
+    char* buffer;
+    size_t length;
+};
+
+// Submits every chunk at once (in groups of the ring size) against the
+// registered container fd; a short transfer (EOF on read, partial write) is
+// finished with the synchronous helpers, which also zero-fill past EOF.
+// With misses given, reads are RWF_NOWAIT and whatever is not in the page
+// cache is listed there instead of being waited for.
+bool data_io_uring(IoUring* ring, OMNIInstance* inst, const vector<DataChunk>& chunks, bool write,
+                   vector<DataChunk>* misses = nullptr) {
+    if (!ring->use_file(inst->data_fd, inst->io_generation)) return false;
+    
+    // Completions carry this call's batch number over the chunk index. Every
+    // SQE the kernel took is reaped before returning, even after an error, so
+    // none completes into a later call's wait or into a buffer that is gone;
+    // one that still turns up later (a failed wait) is skipped by its tag.
+    thread_local uint32_t last_batch = 0;
+    uint64_t batch = static_cast<uint64_t>(++last_batch) << 32;
+    
+    size_t next = 0;
+    while (next < chunks.size()) {
+        size_t group = min<size_t>(chunks.size() - next, ring->capacity());
+        for (size_t i = 0; i < group; i++) {
+            const DataChunk& c = chunks[next + i];
+            io_uring_sqe* sqe = ring->get_sqe();
+            IoUring::prep_rw(sqe, write ? IORING_OP_WRITE : IORING_OP_READ, 0, c.buffer,
+                             static_cast<unsigned>(c.length), c.offset, batch | (next + i));
+            sqe->flags |= IOSQE_FIXED_FILE;
+            if (misses) sqe->rw_flags = RWF_NOWAIT;
+        }
+        int submitted = max(ring->submit(group), 0);
+        bool ok = static_cast<size_t>(submitted) == group;
+        if (!ok) ring->withdraw();
+        
+        for (int reaped = 0; reaped < submitted;) {
+            io_uring_cqe cqe;
+            if (!ring->wait(cqe)) return false;
+            if ((cqe.user_data & ~0xffffffffULL) != batch) continue;
+            reaped++;
+            const DataChunk& c = chunks[cqe.user_data & 0xffffffff];
+            if (misses && cqe.res == -EAGAIN) {
+                misses->push_back(c);
+                continue;
+            }
+            if (cqe.res < 0) {
+                ok = false;
+                continue;
+            }
+            size_t done = static_cast<size_t>(cqe.res);
+            if (done < c.length && misses) {
+                int cached = inst->read_at_nowait(c.offset + done, c.buffer + done, c.length - done);
+                if (cached == 0) misses->push_back({c.offset + done, c.buffer + done, c.length - done});
+                ok = ok && cached >= 0;
+            } else if (done < c.length) {
+                ok = ok && (write ? inst->write_at(c.offset + done, c.buffer + done, c.length - done)
+                                  : inst->read_at(c.offset + done, c.buffer + done, c.length - done));
+            }
+        }
+        if (!ok) return false;
+        next += group;
+    }
+    return true;
+}
+
+// Runs the chunks through the thread's ring when there is more than one,
+// otherwise with the synchronous helpers. misses as in data_io_uring.
+bool data_io_chunks(OMNIInstance* inst, const vector<DataChunk>& chunks, bool write,
+                    vector<DataChunk>* misses = nullptr) {
+    IoUring* ring = IoUring::enabled && chunks.size() > 1 ? IoUring::for_thread() : nullptr;
+    if (ring) return data_io_uring(ring, inst, chunks, write, misses);
+    
+    for (auto& c : chunks) {
+        if (misses) {
+            int cached = inst->read_at_nowait(c.offset, c.buffer, c.length);
+            if (cached < 0) return false;
+            if (cached == 0) misses->push_back(c);
+            continue;
+        }
+        bool ok = write ? inst->write_at(c.offset, c.buffer, c.length)
+                        : inst->read_at(c.offset, c.buffer, c.length);
+        if (!ok) return false;
+    }
+    return true;
+}
+
+// Reads of holes are zero-filled here without touching the disk; writes
+// must not reach a hole or a shared block (claim_blocks_under comes first).
+// misses (reads only) switches to non-blocking reads; see data_io_uring
+bool file_data_io(OMNIInstance* inst, FSNode* node, uint64_t pos, char* buffer, size_t length, bool write,
+                  vector<DataChunk>* misses = nullptr) {
+    if (length == 0) return true;
+    uint32_t block_size = inst->header.block_size;
+    uint32_t first = pos / block_size;
+    uint32_t count = (pos + length - 1) / block_size - first + 1;
+    vector<uint32_t> blocks = inst->free_space.get_file_blocks(node->start_block, first, count);
+    if (blocks.size() < count) return false;
+    
+    vector<DataChunk> chunks;
+    size_t done = 0;
+    while (done < length) {
+        uint32_t block = blocks[(pos + done) / block_size - first];
+        uint32_t in_block = (pos + done) % block_size;
+        size_t chunk = min<size_t>(length - done, block_size - in_block);
+        if (block == HOLE_BLOCK) {
+            if (write) return false;
+            memset(buffer + done, 0, chunk);
+        } else {
+            uint64_t offset = inst->get_data_offset() + static_cast<uint64_t>(block) * block_size + in_block;
+            chunks.push_back({offset, buffer + done, chunk});
+        }
+        done += chunk;
+    }
+    return data_io_chunks(inst, chunks, write, misses);
+}
+
+// Copy-on-write for blocks shared with copies of the file (see file_copy):
+// every shared block under [pos, pos + length) is replaced by a block of the
+// file's own. Only a block the range partly covers needs the old content
+// copied over; the rest is about to be overwritten anyway.
+bool unshare_under(OMNIInstance* inst, FSNode* node, uint64_t pos, size_t length) {
+    uint32_t block_size = inst->header.block_size;
+    uint32_t first = pos / block_size;
+    uint32_t last = (pos + length + block_size - 1) / block_size;
+    vector<uint32_t> replaced;
+    int count = inst->free_space.unshare_blocks(node->start_block, first, last, replaced);
+    if (count <= 0) return count == 0;
+    
+    vector<uint32_t> blocks = inst->free_space.get_file_blocks(node->start_block, first, last - first);
+    vector<size_t> partial;
+    if (pos % block_size != 0) partial.push_back(0);
+    if ((pos + length) % block_size != 0 && (partial.empty() || last - first > 1)) partial.push_back(last - first - 1);
+    
+    bool ok = true;
+    string buffer(block_size, '\0');
+    for (size_t i : partial) {
+        if (replaced[i] == HOLE_BLOCK) continue;
+        uint64_t from = inst->get_data_offset() + static_cast<uint64_t>(replaced[i]) * block_size;
+        uint64_t to = inst->get_data_offset() + static_cast<uint64_t>(blocks[i]) * block_size;
+        ok = ok && inst->read_at(from, &buffer[0], block_size) && inst->write_at(to, buffer.data(), block_size);
+    }
+    inst->free_space.drop_blocks(replaced);
+    return ok;
+}
+
+// Makes every block under [pos, pos + length) the file's own to write: holes
+// get blocks, and a hole the range only partly covers is zeroed around it,
+// as the rest of it has to keep reading as zeros; shared blocks are
+// unshared. Caller holds node exclusively.
+bool claim_blocks_under(OMNIInstance* inst, FSNode* node, uint64_t pos, size_t length) {
+    uint32_t block_size = inst->header.block_size;
+    uint32_t first = pos / block_size;
+    uint32_t last = (pos + length + block_size - 1) / block_size;
+    vector<uint32_t> blocks = inst->free_space.get_file_blocks(node->start_block, first, last - first);
+    if (blocks.size() < last - first) return false;
+    if (find(blocks.begin(), blocks.end(), HOLE_BLOCK) == blocks.end()) {
+        return unshare_under(inst, node, pos, length);
+    }
+    
+    int filled = inst->free_space.fill_holes(node->start_block, first, last);
+    if (filled < 0) return false;
+    inst->file_system.resize_file(node, node->size, node->num_blocks + filled);
+    
+    uint64_t end = pos + length;
+    string zeros;
+    if (blocks.front() == HOLE_BLOCK && pos % block_size != 0) {
+        zeros.assign(pos % block_size, '\0');
+        if (!file_data_io(inst, node, pos - zeros.size(), &zeros[0], zeros.size(), true)) return false;
+    }
+    if (blocks.back() == HOLE_BLOCK && end % block_size != 0) {
+        zeros.assign(block_size - end % block_size, '\0');
+        if (!file_data_io(inst, node, end, &zeros[0], zeros.size(), true)) return false;
+    }
+    return unshare_under(inst, node, pos, length);
+}
+
+// Undoes the hole filling of a claim_blocks_under from entry first on after
+// a failed write: the entries that were holes in before become holes again
+void release_claimed(OMNIInstance* inst, FSNode* node, uint32_t first, const vector<uint32_t>& before) {
+    uint32_t released = 0;
+    for (size_t i = 0; i < before.size();) {
+        if (before[i] != HOLE_BLOCK) {
+            i++;
+            continue;
+        }
+        size_t run = i;
+        while (i < before.size() && before[i] == HOLE_BLOCK) i++;
+        released += inst->free_space.punch_holes(node->start_block, first + run, first + i);
+    }
+    if (released > 0) inst->file_system.resize_file(node, node->size, node->num_blocks - released);
+}
+
+// Files created under a directory with compression on (see
+// dir_set_compression) are stored in chunks of COMPRESSION_CHUNK_BLOCKS
+// blocks, each compressed on its own. A compressed chunk keeps its data in
+// the first blocks it needs and the rest of its blocks are holes; one that
+// would not save a whole block is stored as is. The chunk map says which is
+// which, so reads and writes only decompress the chunks they touch.
+#define COMPRESSION_CHUNK_BLOCKS 4
+
+uint64_t chunk_bytes(OMNIInstance* inst) {
+    return static_cast<uint64_t>(inst->header.block_size) * COMPRESSION_CHUNK_BLOCKS;
+}
+
+uint32_t stored_size(FSNode* node, uint64_t chunk) {
+    const vector<uint32_t>& stored = node->chunk_map->stored;
+    return chunk < stored.size() ? stored[chunk] : 0;
+}
+
+uint64_t elapsed_ns(chrono::steady_clock::time_point since) {
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - since).count();
+}
+
+// Reads [pos, pos + length) of a compressed file. A compressed chunk is read
+// whole and decompressed (into zeros: a chunk the file grew past reads back
+// zeros after its data). With misses, nothing is decompressed once a read
+// has missed the page cache, as the caller retries anyway.
+bool read_compressed(OMNIInstance* inst, FSNode* node, uint64_t pos, char* buffer, size_t length,
+                     vector<DataChunk>* misses) {
+    uint64_t chunk_size = chunk_bytes(inst);
+    string packed, plain;
+    size_t done = 0;
+    while (done < length) {
+        uint64_t at = pos + done;
+        uint64_t chunk = at / chunk_size;
+        uint64_t in_chunk = at % chunk_size;
+        size_t n = min<uint64_t>(length - done, chunk_size - in_chunk);
+        uint32_t stored = stored_size(node, chunk);
+        if (stored == 0) {
+            if (!file_data_io(inst, node, at, buffer + done, n, false, misses)) return false;
+        } else {
+            packed.resize(stored);
+            if (!file_data_io(inst, node, chunk * chunk_size, &packed[0], stored, false, misses)) return false;
+            if (!misses || misses->empty()) {
+                plain.assign(chunk_size, '\0');
+                size_t written = 0;
+                auto start = chrono::steady_clock::now();
+                if (!lz4_decompress(packed.data(), stored, &plain[0], chunk_size, written)) return false;
+                inst->codec.decompress_ns += elapsed_ns(start);
+                inst->codec.decompressed_bytes += written;
+                memcpy(buffer + done, plain.data() + in_chunk, n);
+            }
+        }
+        done += n;
+    }
+    return true;
+}
+
+// Stores one whole chunk of a compressed file: compressed if that saves at
+// least a block, else as is. Caller holds node exclusively and has set the
+// file's length.
+bool store_chunk(OMNIInstance* inst, FSNode* node, uint64_t chunk, const string& plain) {
+    uint32_t block_size = inst->header.block_size;
+    uint64_t start = chunk * chunk_bytes(inst);
+    uint32_t chunk_blocks = (plain.size() + block_size - 1) / block_size;
+    
+    string packed(lz4_bound(plain.size()), '\0');
+    auto begin = chrono::steady_clock::now();
+    size_t packed_size = lz4_compress(plain.data(), plain.size(), &packed[0], packed.size());
+    inst->codec.compress_ns += elapsed_ns(begin);
+    inst->codec.compressed_bytes += plain.size();
+    uint32_t packed_blocks = (packed_size + block_size - 1) / block_size;
+    
+    vector<uint32_t>& stored = node->chunk_map->stored;
+    if (stored.size() <= chunk) stored.resize(chunk + 1, 0);
+    // The map only changes once the chunk's blocks are claimed
+    if (packed_size == 0 || packed_blocks >= chunk_blocks) {
+        if (!claim_blocks_under(inst, node, start, plain.size())) return false;
+        stored[chunk] = 0;
+        return file_data_io(inst, node, start, const_cast<char*>(plain.data()), plain.size(), true);
+    }
+    
+    if (!claim_blocks_under(inst, node, start, packed_size)) return false;
+    stored[chunk] = packed_size;
+    uint32_t first = chunk * COMPRESSION_CHUNK_BLOCKS;
+    uint32_t punched = inst->free_space.punch_holes(node->start_block, first + packed_blocks, first + chunk_blocks);
+    inst->file_system.resize_file(node, node->size, node->num_blocks - punched);
+    inst->codec.stored_raw += plain.size();
+    inst->codec.stored_packed += packed_size;
+    return file_data_io(inst, node, start, &packed[0], packed_size, true);
+}
+
+// Writes [pos, pos + length) of a compressed file a chunk at a time; a chunk
+// the write only partly covers is read back and patched first. Caller holds
+// node exclusively and has set the file's length.
+bool write_compressed(OMNIInstance* inst, FSNode* node, uint64_t pos, const char* data, size_t length) {
+    uint64_t chunk_size = chunk_bytes(inst);
+    string plain;
+    size_t done = 0;
+    while (done < length) {
+        uint64_t at = pos + done;
+        uint64_t chunk = at / chunk_size;
+        uint64_t in_chunk = at % chunk_size;
+        uint64_t start = chunk * chunk_size;
+        size_t chunk_length = min<uint64_t>(chunk_size, node->size - start);
+        size_t n = min<uint64_t>(length - done, chunk_length - in_chunk);
+        
+        plain.assign(chunk_length, '\0');
+        if (n < chunk_length && !read_compressed(inst, node, start, &plain[0], chunk_length, nullptr)) return false;
+        memcpy(&plain[in_chunk], data + done, n);
+        if (!store_chunk(inst, node, chunk, plain)) return false;
+        done += n;
+    }
+    return true;
+}
+
+// Dedup mode: each block the write fully determines (a whole block, or one
+// the write fills up to the end of the file, zero-padded) is fingerprinted.
+// If the same content is already stored, the file takes a share of that
+// block instead and its own is released; otherwise it is written and indexed.
+// Caller has claimed the blocks under the range.
+bool write_deduplicated(OMNIInstance* inst, FSNode* node, uint64_t pos, const char* data, size_t length) {
+    uint32_t block_size = inst->header.block_size;
+    uint32_t first = pos / block_size;
+    uint32_t last = (pos + length + block_size - 1) / block_size;
+    vector<uint32_t> blocks = inst->free_space.get_file_blocks(node->start_block, first, last - first);
+    if (blocks.size() < last - first) return false;
+    
+    vector<DataChunk> chunks;
+    vector<pair<uint32_t, uint64_t>> written;
+    map<uint64_t, pair<uint32_t, const char*>> in_write;  // blocks this write stores itself
+    string tail, stored(block_size, '\0');
+    for (uint32_t i = 0; i < blocks.size(); i++) {
+        uint64_t block_start = static_cast<uint64_t>(first + i) * block_size;
+        uint64_t start = max(pos, block_start);
+        uint64_t end = min(pos + length, block_start + block_size);
+        const char* content = data + (start - pos);
+        uint64_t offset = inst->get_data_offset() + static_cast<uint64_t>(blocks[i]) * block_size;
+        if (start != block_start || (end - start < block_size && end != node->size)) {
+            chunks.push_back({offset + (start - block_start), const_cast<char*>(content), end - start});
+            continue;
+        }
+        if (end - start < block_size) {
+            tail.assign(content, end - start);
+            tail.resize(block_size, '\0');
+            content = tail.data();
+        }
+        
+        uint64_t fingerprint = hash<string_view>{}(string_view(content, block_size));
+        auto same = in_write.find(fingerprint);
+        if (same != in_write.end() && memcmp(same->second.second, content, block_size) == 0) {
+            inst->free_space.hold_block(same->second.first);
+            inst->free_space.replace_block(node->start_block, first + i, same->second.first);
+            continue;
+        }
+        uint32_t existing = inst->free_space.share_fingerprint(fingerprint, blocks[i]);
+        if (existing != HOLE_BLOCK) {
+            uint64_t existing_offset = inst->get_data_offset() + static_cast<uint64_t>(existing) * block_size;
+            if (inst->read_at(existing_offset, &stored[0], block_size) && memcmp(stored.data(), content, block_size) == 0) {
+                inst->free_space.replace_block(node->start_block, first + i, existing);
+                continue;
+            }
+            inst->free_space.drop_blocks({existing});
+        }
+        chunks.push_back({offset, const_cast<char*>(content), block_size});
+        written.push_back({blocks[i], fingerprint});
+        in_write.emplace(fingerprint, make_pair(blocks[i], content));
     }
     
-    Session* sess = static_cast<Session*>(session);
-    OMNIInstance* inst = sess->instance;
+    if (!data_io_chunks(inst, chunks, true)) return false;
+    for (auto& [block, fingerprint] : written) inst->free_space.add_fingerprint(block, fingerprint);
+    return true;
+}
+
+// The write itself, once the blocks under the range are claimed (compressed
+// files claim theirs chunk by chunk)
+bool store_file_data(OMNIInstance* inst, FSNode* node, uint64_t pos, const char* data, size_t length) {
+    if (node->chunk_map) return write_compressed(inst, node, pos, data, length);
+    if (inst->header.dedup && length > 0) return write_deduplicated(inst, node, pos, data, length);
+    return file_data_io(inst, node, pos, const_cast<char*>(data), length, true);
+}
+
+bool write_file_data(OMNIInstance* inst, FSNode* node, uint64_t pos, const char* data, size_t length) {
+    if (length > 0 && !node->chunk_map && !claim_blocks_under(inst, node, pos, length)) return false;
+    return store_file_data(inst, node, pos, data, length);
+}
+
+bool read_file_data(OMNIInstance* inst, FSNode* node, uint64_t pos, char* buffer, size_t length,
+                    vector<DataChunk>* misses = nullptr) {
+    if (node->chunk_map) return read_compressed(inst, node, pos, buffer, length, misses);
+    return file_data_io(inst, node, pos, buffer, length, false, misses);
+}
+
+// Keeps an undo record if the session is inside an atomic batch
+void record_change(Session* sess, Change change) {
+    if (sess->change_log) sess->change_log->changes.push_back(std::move(change));
+}
+
+// Sets node's length and updates the usage counters. Growing only appends
+// holes; shrinking releases the blocks past the new end and leaves the rest
+// of the new last block as it is (see zero_tail). A compressed chunk the new
+// end cuts through is stored again from what is kept of it. Caller holds
+// node exclusively.
+bool set_file_length(OMNIInstance* inst, FSNode* node, uint64_t new_size) {
+    uint32_t block_size = inst->header.block_size;
+    string kept;
+    uint64_t cut_chunk = 0;
+    if (node->chunk_map && new_size < node->size) {
+        cut_chunk = new_size / chunk_bytes(inst);
+        if (new_size % chunk_bytes(inst) != 0 && stored_size(node, cut_chunk) > 0) {
+            kept.resize(new_size % chunk_bytes(inst));
+            if (!read_compressed(inst, node, cut_chunk * chunk_bytes(inst), &kept[0], kept.size(), nullptr)) {
+                return false;
+            }
+            node->chunk_map->stored[cut_chunk] = 0;
+        }
+    }
     
-    FSNode* existing = inst->file_system.find_node(path);
-    if (existing) {
-        return static_cast<int>(OFSErrorCodes::ERROR_FILE_EXISTS);
+    uint32_t entries = (node->size + block_size - 1) / block_size;
+    uint32_t needed = (new_size + block_size - 1) / block_size;
+    uint32_t blocks = node->num_blocks;
+    if (needed > entries) {
+        if (node->start_block == 0) {
+            uint32_t file_id = inst->free_space.allocate_holes(needed);
+            if (file_id == 0) return false;
+            node->start_block = file_id;
+        } else if (!inst->free_space.extend_holes(node->start_block, needed - entries)) {
+            return false;
+        }
+    } else if (needed < entries) {
+        if (needed == 0) {
+            inst->free_space.free_blocks(node->start_block, node->num_blocks);
+            node->start_block = 0;
+            blocks = 0;
+        } else {
+            blocks -= inst->free_space.shrink_blocks(node->start_block, needed);
+        }
+    }
+    inst->file_system.resize_file(node, new_size, blocks);
+    
+    if (node->chunk_map) {
+        node->chunk_map->stored.resize((new_size + chunk_bytes(inst) - 1) / chunk_bytes(inst), 0);
+        if (!kept.empty()) return store_chunk(inst, node, cut_chunk, kept);
+    }
+    return true;
+}
+
+// The policy of the nearest directory above node that sets one, else the
+// filesystem's default. Caller holds the path to node.
+bool compression_wanted(OMNIInstance* inst, FSNode* node) {
+    for (FSNode* dir = node->parent; dir; dir = dir->parent) {
+        if (dir->compression != CompressionPolicy::INHERIT) return dir->compression == CompressionPolicy::ON;
     }
+    return inst->header.compression;
+}
+
+// file_create without the change record. Rolling back a delete passes the
+// deleted file's record to bring it back under its old owner and permissions.
+int create_file(Session* sess, const char* path, const char* data, size_t size, const Change* restore = nullptr) {
+    OMNIInstance* inst = sess->instance;
+    SharedLock lock(&inst->fs_lock);
     
-    FSNode* node = inst->file_system.create_node(path, EntryType::FILE, sess->user->username);
+    PathLocks locks;
+    bool exists = false;
+    const string& owner = restore ? restore->owner : sess->user->username;
+    FSNode* node = inst->file_system.create_node(path, EntryType::FILE, owner, locks, &exists);
     if (!node) {
-        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_PATH);
+        return static_cast<int>(exists ? OFSErrorCodes::ERROR_FILE_EXISTS : OFSErrorCodes::ERROR_INVALID_PATH);
+    }
+    if (restore) node->permissions = restore->permissions;
+    
+    FileSystem::QuotaHold quota;
+    if (!inst->file_system.reserve_quota(node, size, inst->header.user_quota, quota)) {
+        inst->file_system.unlink_node(node, locks);
+        return static_cast<int>(OFSErrorCodes::ERROR_NO_SPACE);
     }
     
-    if (data && size > 0) {
+    if (compression_wanted(inst, node)) node->chunk_map = new ChunkMap();
+    
+    if (data && size > 0 && node->chunk_map) {
+        // Blocks are taken chunk by chunk, as many as each compresses to
+        if (!set_file_length(inst, node, size) || !write_compressed(inst, node, 0, data, size)) {
+            set_file_length(inst, node, 0);
+            inst->file_system.unlink_node(node, locks);
+            return static_cast<int>(OFSErrorCodes::ERROR_NO_SPACE);
+        }
+    } else if (data && size > 0) {
         uint32_t blocks_needed = (size + inst->header.block_size - 1) / inst->header.block_size;
-        int start_block = inst->free_space.allocate_blocks(blocks_needed);
+        uint32_t file_id = inst->free_space.allocate_blocks(blocks_needed);
         
-        if (start_block == -1) {
-            inst->file_system.delete_node(path);
+        if (file_id == 0) {
+            inst->file_system.unlink_node(node, locks);
             return static_cast<int>(OFSErrorCodes::ERROR_NO_SPACE);
         }
         
-        node->start_block = start_block;
-        node->num_blocks = blocks_needed;
-        node->size = size;
+        node->start_block = file_id;
+        inst->file_system.resize_file(node, size, blocks_needed);
         
-        uint64_t offset = inst->get_data_offset() + (start_block * inst->header.block_size);
-        inst->omni_file.seekp(offset, ios::beg);
-        inst->omni_file.write(data, size);
-        inst->omni_file.flush();
+        if (!write_file_data(inst, node, 0, data, size)) {
+            set_file_length(inst, node, 0);
+            inst->file_system.unlink_node(node, locks);
+            return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+        }
     }
     
     cout << "✓ File created: " << path << " (" << size << " bytes)\n";
@@ -404,129 +910,258 @@ int file_create(void* session, const char* path, const char* data, size_t size)
     return static_cast<int>(OFSErrorCodes::SUCCESS);
 }
 
-int file_read(void* session, const char* path, char** buffer, size_t* size) {
-    if (!session || !path || !buffer || !size) {
+// Before a file grows from old_size: zeroes what its last block holds past
+// the old end (up to until), which may be left over from a longer past
+bool zero_tail(OMNIInstance* inst, FSNode* node, uint64_t old_size, uint64_t until) {
+    uint32_t block_size = inst->header.block_size;
+    uint64_t block_end = (old_size + block_size - 1) / block_size * block_size;
+    uint64_t end = min(until, block_end);
+    if (end <= old_size) return true;
+    // A compressed chunk already reads as zeros past its data
+    if (node->chunk_map && stored_size(node, old_size / chunk_bytes(inst)) > 0) return true;
+    
+    vector<uint32_t> last = inst->free_space.get_file_blocks(node->start_block, old_size / block_size, 1);
+    if (last.empty() || last[0] == HOLE_BLOCK) return true;
+    if (!unshare_under(inst, node, old_size, end - old_size)) return false;
+    string zeros(end - old_size, '\0');
+    return file_data_io(inst, node, old_size, &zeros[0], zeros.size(), true);
+}
+
+// Writes data at pos, growing the file first if the write ends past it. Any
+// gap between the old end and pos becomes holes, and only the blocks the
+// write touches are allocated and written.
+int write_extending(OMNIInstance* inst, FSNode* node, uint64_t pos, const char* data, size_t size) {
+    uint64_t old_size = node->size;
+    uint64_t end = pos + size;
+    if (end < pos) return static_cast<int>(OFSErrorCodes::ERROR_NO_SPACE);
+    FileSystem::QuotaHold quota;
+    if (end > old_size) {
+        // As in file_truncate, no file is longer than the data area
+        if (end > inst->header.total_size - inst->get_data_offset() ||
+            !inst->file_system.reserve_quota(node, end - old_size, inst->header.user_quota, quota)) {
+            return static_cast<int>(OFSErrorCodes::ERROR_NO_SPACE);
+        }
+        if (!zero_tail(inst, node, old_size, pos)) {
+            return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+        }
+        if (!set_file_length(inst, node, end)) {
+            return static_cast<int>(OFSErrorCodes::ERROR_NO_SPACE);
+        }
+    }
+    if (node->chunk_map) {
+        // Chunks claim their blocks as they are stored
+        if (!write_compressed(inst, node, pos, data, size)) {
+            if (end > old_size) set_file_length(inst, node, old_size);
+            return static_cast<int>(OFSErrorCodes::ERROR_NO_SPACE);
+        }
+        return static_cast<int>(OFSErrorCodes::SUCCESS);
+    }
+    if (size == 0) return static_cast<int>(OFSErrorCodes::SUCCESS);
+    
+    // A failed write gives back the blocks it claimed and the old length
+    uint32_t block_size = inst->header.block_size;
+    uint32_t first = pos / block_size;
+    vector<uint32_t> before = inst->free_space.get_file_blocks(node->start_block, first,
+                                                               (end + block_size - 1) / block_size - first);
+    int result = static_cast<int>(OFSErrorCodes::SUCCESS);
+    if (!claim_blocks_under(inst, node, pos, size)) {
+        result = static_cast<int>(OFSErrorCodes::ERROR_NO_SPACE);
+    } else if (!store_file_data(inst, node, pos, data, size)) {
+        result = static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+    }
+    if (result != static_cast<int>(OFSErrorCodes::SUCCESS)) {
+        release_claimed(inst, node, first, before);
+        if (end > old_size) set_file_length(inst, node, old_size);
+    }
+    return result;
+}
+
+int file_create(void* session, const char* path, const char* data, size_t size) {
+    if (!session || !path) {
         return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
     }
     
     Session* sess = static_cast<Session*>(session);
-    OMNIInstance* inst = sess->instance;
-    
-    FSNode* node = inst->file_system.find_node(path);
-    if (!node) {
-        return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+    int result = create_file(sess, path, data, size);
+    if (result == static_cast<int>(OFSErrorCodes::SUCCESS)) {
+        record_change(sess, Change{ChangeKind::FILE_CREATED, path, "", 0, "", "", 0, 0});
     }
-    
+    return result;
+}
+
+// With misses given, content is read without waiting on the disk; if any
+// block is not in the page cache it is listed there and nothing is returned.
+// Reads [offset, offset + length) clamped to the file, by default all of it.
+int read_file_node(OMNIInstance* inst, FSNode* node, char** buffer, size_t* size,
+                   vector<DataChunk>* misses = nullptr, uint64_t offset = 0, uint64_t length = UINT64_MAX) {
     if (node->type != EntryType::FILE) {
         return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
     }
     
-    char* data = (char*)malloc(node->size + 1);
+    offset = min(offset, node->size);
+    length = min(length, node->size - offset);
+    char* data = (char*)malloc(length + 1);
     if (!data) {
         return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
     }
     
-    if (node->size > 0) {
-        uint64_t offset = inst->get_data_offset() + (node->start_block * inst->header.block_size);
-        inst->omni_file.seekg(offset, ios::beg);
-        inst->omni_file.read(data, node->size);
+    if (length > 0) {
+        if (!read_file_data(inst, node, offset, data, length, misses)) {
+            free(data);
+            return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+        }
+        if (misses && !misses->empty()) {
+            free(data);
+            return static_cast<int>(OFSErrorCodes::SUCCESS);
+        }
     }
     
-    data[node->size] = '\0';
+    data[length] = '\0';
     *buffer = data;
-    *size = node->size;
-    
-    cout << "✓ File read: " << path << " (" << node->size << " bytes)\n";
-    sess->operations_count++;
-    sess->last_activity = time(nullptr);
+    *size = length;
     
     return static_cast<int>(OFSErrorCodes::SUCCESS);
 }
 
-int file_edit(void* session, const char* path, const char* data, size_t size, uint index) {
-    if (!session || !path || !data) {
-        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+#define NOWAIT_READ_ATTEMPTS 3
+#define WARM_READ_MAX (64 * 1024)
+
+// Reads a file from a request coroutine. Content is first read under the
+// locks without waiting on the disk; if some blocks are not cached, the locks
+// are dropped, the coroutine suspends while the reactor reads those ranges
+// into the page cache, and the lookup starts over (the file may have changed
+// in between). After NOWAIT_READ_ATTEMPTS rounds it settles for a blocking
+// read. Without a reactor that has io_uring this is just the blocking read.
+// The file is looked up by path, or by inode and generation when path is null.
+task<int> read_node_async(OMNIInstance* inst, const string* path, uint32_t inode, uint32_t generation,
+                          char** buffer, size_t* size, uint64_t offset = 0, uint64_t length = UINT64_MAX) {
+    Reactor* reactor = Reactor::current();
+    bool nowait = reactor && reactor->has_ring();
+    
+    for (int attempt = 0;; attempt++) {
+        vector<DataChunk> misses;
+        int result;
+        {
+            SharedLock lock(&inst->fs_lock);
+            PathLocks locks;
+            FSNode* node = path ? inst->file_system.lookup(*path, locks)
+                                : inst->file_system.lock_inode(inode, generation, locks, LockMode::SHARED);
+            if (!node) {
+                co_return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+            }
+            result = read_file_node(inst, node, buffer, size,
+                                    nowait && attempt < NOWAIT_READ_ATTEMPTS ? &misses : nullptr, offset, length);
+        }
+        if (misses.empty()) {
+            co_return result;
+        }
+        
+        // Adjacent blocks are warmed with one read; errors show up on the retry
+        vector<Reactor::Range> ranges;
+        size_t largest = 0;
+        for (auto& m : misses) {
+            Reactor::Range* last = ranges.empty() ? nullptr : &ranges.back();
+            if (last && last->offset + last->length == m.offset && last->length + m.length <= WARM_READ_MAX) {
+                last->length += m.length;
+            } else {
+                ranges.push_back({m.offset, m.length});
+            }
+            largest = max(largest, ranges.back().length);
+        }
+        vector<char> scratch(largest);
+        co_await reactor->read_ranges(inst->data_fd, scratch.data(), ranges);
+    }
+}
+
+task<int> file_read_async(void* session, string path, char** buffer, size_t* size) {
+    if (!session || !buffer || !size) {
+        co_return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
     }
     
     Session* sess = static_cast<Session*>(session);
     OMNIInstance* inst = sess->instance;
-    
-    FSNode* node = inst->file_system.find_node(path);
-    if (!node) {
-        return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+    int result = co_await read_node_async(inst, &path, 0, 0, buffer, size);
+    if (result != static_cast<int>(OFSErrorCodes::SUCCESS)) {
+        co_return result;
     }
     
-    if (node->type != EntryType::FILE) {
-        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
-    }
+    cout << "✓ File read: " << path << " (" << *size << " bytes)\n";
+    sess->operations_count++;
+    sess->last_activity = time(nullptr);
     
-    if (node->owner != sess->user->username && sess->user->role != UserRole::ADMIN) {
-        return static_cast<int>(OFSErrorCodes::ERROR_PERMISSION_DENIED);
+    co_return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+task<int> file_read_by_inode_async(void* session, uint32_t inode, uint32_t generation, char** buffer, size_t* size) {
+    if (!session || !buffer || !size) {
+        co_return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
     }
     
-    if (index + size > node->size) {
-        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    Session* sess = static_cast<Session*>(session);
+    OMNIInstance* inst = sess->instance;
+    int result = co_await read_node_async(inst, nullptr, inode, generation, buffer, size);
+    if (result != static_cast<int>(OFSErrorCodes::SUCCESS)) {
+        co_return result;
     }
     
-    uint64_t offset = inst->get_data_offset() + (node->start_block * inst->header.block_size) + index;
-    inst->omni_file.seekp(offset, ios::beg);
-    inst->omni_file.write(data, size);
-    inst->omni_file.flush();
-    
-    node->modified_time = time(nullptr);
-    
-    cout << "✓ File edited: " << path << " (offset: " << index << ", size: " << size << ")\n";
+    cout << "✓ File read: inode " << inode << " (" << *size << " bytes)\n";
     sess->operations_count++;
     sess->last_activity = time(nullptr);
     
-    return static_cast<int>(OFSErrorCodes::SUCCESS);
+    co_return static_cast<int>(OFSErrorCodes::SUCCESS);
 }
 
-int file_delete(void* session, const char* path) {
-    if (!session || !path) {
-        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+// Reads length bytes from offset, or as many as the file has there. On a
+// compressed file only the chunks the range touches are decompressed.
+task<int> file_read_range_async(void* session, string path, uint64_t offset, uint64_t length,
+                                char** buffer, size_t* size) {
+    if (!session || !buffer || !size) {
+        co_return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
     }
     
     Session* sess = static_cast<Session*>(session);
     OMNIInstance* inst = sess->instance;
-    
-    FSNode* node = inst->file_system.find_node(path);
-    if (!node) {
-        return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+    int result = co_await read_node_async(inst, &path, 0, 0, buffer, size, offset, length);
+    if (result != static_cast<int>(OFSErrorCodes::SUCCESS)) {
+        co_return result;
     }
     
-    if (node->type != EntryType::FILE) {
-        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
-    }
-    
-    if (node->owner != sess->user->username && sess->user->role != UserRole::ADMIN) {
-        return static_cast<int>(OFSErrorCodes::ERROR_PERMISSION_DENIED);
-    }
+    cout << "✓ File read: " << path << " (offset: " << offset << ", " << *size << " bytes)\n";
+    sess->operations_count++;
+    sess->last_activity = time(nullptr);
     
-    if (node->num_blocks > 0) {
-        inst->free_space.free_blocks(node->start_block, node->num_blocks);
+    co_return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+int file_read(void* session, const char* path, char** buffer, size_t* size) {
+    if (!path) {
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
     }
-    
-    if (!inst->file_system.delete_node(path)) {
+    return sync_wait(file_read_async(session, path, buffer, size));
+}
+
+int file_read_by_inode(void* session, uint32_t inode, uint32_t generation, char** buffer, size_t* size) {
+    return sync_wait(file_read_by_inode_async(session, inode, generation, buffer, size));
+}
+
+int file_read_range(void* session, const char* path, uint64_t offset, uint64_t length, char** buffer, size_t* size) {
+    if (!path) {
         return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
     }
-    
-    cout << "✓ File deleted: " << path << "\n";
-    sess->operations_count++;
-    sess->last_activity = time(nullptr);
-    
-    return static_cast<int>(OFSErrorCodes::SUCCESS);
+    return sync_wait(file_read_range_async(session, path, offset, length, buffer, size));
 }
 
-int file_truncate(void* session, const char* path) {
-    if (!session || !path) {
+int file_edit(void* session, const char* path, const char* data, size_t size, uint64_t index) {
+    if (!session || !path || !data) {
         return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
     }
     
     Session* sess = static_cast<Session*>(session);
     OMNIInstance* inst = sess->instance;
+    SharedLock lock(&inst->fs_lock);
     
-    FSNode* node = inst->file_system.find_node(path);
+    PathLocks locks;
+    FSNode* node = inst->file_system.lock_path(path, locks, LockMode::EXCLUSIVE);
     if (!node) {
         return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
     }
@@ -539,116 +1174,445 @@ int file_truncate(void* session, const char* path) {
         return static_cast<int>(OFSErrorCodes::ERROR_PERMISSION_DENIED);
     }
     
-    const char* pattern = "siruamr";
-    size_t pattern_len = strlen(pattern);
-    
-    if (node->size > 0) {
-        uint64_t offset = inst->get_data_offset() + (node->start_block * inst->header.block_size);
-        inst->omni_file.seekp(offset, ios::beg);
-        
-        for (size_t i = 0; i < node->size; i += pattern_len) {
-            size_t write_len = min(pattern_len, node->size - i);
-            inst->omni_file.write(pattern, write_len);
+    uint64_t old_size = node->size;
+    string old_data;
+    if (sess->change_log && index < old_size) {
+        old_data.resize(min<uint64_t>(size, old_size - index));
+        if (!read_file_data(inst, node, index, &old_data[0], old_data.size())) {
+            return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
         }
-        inst->omni_file.flush();
     }
     
+    // Writing past the end grows the file
+    int result = write_extending(inst, node, index, data, size);
+    if (result != static_cast<int>(OFSErrorCodes::SUCCESS)) {
+        return result;
+    }
+    record_change(sess, Change{ChangeKind::FILE_EDITED, path, "", index, std::move(old_data), "", 0, old_size});
+    
     node->modified_time = time(nullptr);
     
-    cout << "✓ File truncated: " << path << "\n";
+    cout << "✓ File edited: " << path << " (offset: " << index << ", size: " << size << ")\n";
     sess->operations_count++;
     sess->last_activity = time(nullptr);
     
     return static_cast<int>(OFSErrorCodes::SUCCESS);
 }
 
-int file_exists(void* session, const char* path) {
-    if (!session || !path) {
+// Copies a file without copying its content: the copy takes a share of the
+// source's blocks, and whichever file is written to later copies the blocks
+// it changes first (see unshare_under).
+int file_copy(void* session, const char* src_path, const char* dst_path) {
+    if (!session || !src_path || !dst_path) {
         return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
     }
     
     Session* sess = static_cast<Session*>(session);
     OMNIInstance* inst = sess->instance;
+    SharedLock lock(&inst->fs_lock);
+    
+    uint64_t size;
+    uint32_t blocks;
+    uint32_t file_id = 0;
+    unique_ptr<ChunkMap> chunks;
+    {
+        PathLocks locks;
+        FSNode* src = inst->file_system.lookup(src_path, locks);
+        if (!src) {
+            return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+        }
+        if (src->type != EntryType::FILE) {
+            return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+        }
+        size = src->size;
+        blocks = src->num_blocks;
+        if (src->start_block != 0) {
+            file_id = inst->free_space.share_blocks(src->start_block);
+            if (file_id == 0) {
+                return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+            }
+        }
+        // The copy keeps the source's layout, compressed or not
+        if (src->chunk_map) chunks.reset(new ChunkMap(*src->chunk_map));
+    }
     
-    FSNode* node = inst->file_system.find_node(path);
-    if (!node || node->type != EntryType::FILE) {
-        return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+    PathLocks locks;
+    bool exists = false;
+    FSNode* node = inst->file_system.create_node(dst_path, EntryType::FILE, sess->user->username, locks, &exists);
+    if (!node) {
+        if (file_id) inst->free_space.free_blocks(file_id, blocks);
+        return static_cast<int>(exists ? OFSErrorCodes::ERROR_FILE_EXISTS : OFSErrorCodes::ERROR_INVALID_PATH);
+    }
+    
+    FileSystem::QuotaHold quota;
+    if (!inst->file_system.reserve_quota(node, size, inst->header.user_quota, quota)) {
+        inst->file_system.unlink_node(node, locks);
+        if (file_id) inst->free_space.free_blocks(file_id, blocks);
+        return static_cast<int>(OFSErrorCodes::ERROR_NO_SPACE);
     }
     
+    node->start_block = file_id;
+    node->chunk_map = chunks.release();
+    inst->file_system.resize_file(node, size, blocks);
+    record_change(sess, Change{ChangeKind::FILE_CREATED, dst_path, "", 0, "", "", 0, 0});
+    
+    cout << "✓ File copied: " << src_path << " -> " << dst_path << " (" << size << " bytes)\n";
     sess->operations_count++;
     sess->last_activity = time(nullptr);
     
     return static_cast<int>(OFSErrorCodes::SUCCESS);
 }
 
-int file_rename(void* session, const char* old_path, const char* new_path) {
-    if (!session || !old_path || !new_path) {
+int file_append(void* session, const char* path, const char* data, size_t size) {
+    if (!session || !path || !data) {
         return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
     }
     
     Session* sess = static_cast<Session*>(session);
     OMNIInstance* inst = sess->instance;
+    SharedLock lock(&inst->fs_lock);
     
-    FSNode* node = inst->file_system.find_node(old_path);
+    PathLocks locks;
+    FSNode* node = inst->file_system.lock_path(path, locks, LockMode::EXCLUSIVE);
     if (!node) {
         return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
     }
     
-    if (inst->file_system.find_node(new_path)) {
-        return static_cast<int>(OFSErrorCodes::ERROR_FILE_EXISTS);
+    if (node->type != EntryType::FILE) {
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
     }
     
     if (node->owner != sess->user->username && sess->user->role != UserRole::ADMIN) {
         return static_cast<int>(OFSErrorCodes::ERROR_PERMISSION_DENIED);
     }
     
-    size_t last_slash = new_path ? string(new_path).find_last_of('/') : string::npos;
-    string new_name = new_path ? string(new_path).substr(last_slash + 1) : "";
+    uint64_t old_size = node->size;
+    int result = write_extending(inst, node, old_size, data, size);
+    if (result != static_cast<int>(OFSErrorCodes::SUCCESS)) {
+        return result;
+    }
+    record_change(sess, Change{ChangeKind::FILE_EDITED, path, "", old_size, "", "", 0, old_size});
     
-    node->name = new_name;
     node->modified_time = time(nullptr);
     
-    cout << "✓ File renamed: " << old_path << " -> " << new_path << "\n";
+    cout << "✓ File appended: " << path << " (" << size << " bytes, now " << node->size << ")\n";
     sess->operations_count++;
     sess->last_activity = time(nullptr);
     
     return static_cast<int>(OFSErrorCodes::SUCCESS);
 }
 
-int dir_create(void* session, const char* path) {
+int file_delete(void* session, const char* path) {
     if (!session || !path) {
         return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
     }
     
     Session* sess = static_cast<Session*>(session);
     OMNIInstance* inst = sess->instance;
+    SharedLock lock(&inst->fs_lock);
     
-    FSNode* existing = inst->file_system.find_node(path);
-    if (existing) {
-        return static_cast<int>(OFSErrorCodes::ERROR_FILE_EXISTS);
-    }
-    
-    FSNode* node = inst->file_system.create_node(path, EntryType::DIRECTORY, sess->user->username);
+    PathLocks locks;
+    FSNode* node = inst->file_system.lock_path(path, locks, LockMode::EXCLUSIVE, LockMode::EXCLUSIVE);
     if (!node) {
-        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_PATH);
+        return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
     }
     
-    cout << "✓ Directory created: " << path << "\n";
-    sess->operations_count++;
-    sess->last_activity = time(nullptr);
+    if (node->type != EntryType::FILE) {
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    }
     
-    return static_cast<int>(OFSErrorCodes::SUCCESS);
+    if (node->owner != sess->user->username && sess->user->role != UserRole::ADMIN) {
+        return static_cast<int>(OFSErrorCodes::ERROR_PERMISSION_DENIED);
+    }
+    
+    if (sess->change_log) {
+        Change change{ChangeKind::FILE_DELETED, path, "", 0, string(node->size, '\0'), node->owner, node->permissions, 0};
+        if (node->size > 0 && !read_file_data(inst, node, 0, &change.data[0], node->size)) {
+            return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+        }
+        record_change(sess, std::move(change));
+    }
+    
+    if (node->start_block != 0) {
+        inst->free_space.free_blocks(node->start_block, node->num_blocks);
+    }
+    
+    inst->file_system.unlink_node(node, locks);
+    
+    cout << "✓ File deleted: " << path << "\n";
+    sess->operations_count++;
+    sess->last_activity = time(nullptr);
+    
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
 }
 
-int dir_list(void* session, const char* path, FileEntry** entries, int* count) {
-    if (!session || !path || !entries || !count) {
+// Writes pattern over the whole file a block at a time. Every block is a
+// window into one buffer of block_size plus a pattern's length, starting at
+// the pattern phase where that block begins, so the fill needs one block of
+// memory however large the file is and goes out as whole-block writes.
+// Compressed files are filled the same way a chunk at a time.
+bool fill_pattern(OMNIInstance* inst, FSNode* node, const char* pattern) {
+    uint32_t block_size = inst->header.block_size;
+    size_t pattern_len = strlen(pattern);
+    uint64_t span = node->chunk_map ? chunk_bytes(inst) : block_size;
+    string window(span + pattern_len, '\0');
+    memcpy(&window[0], pattern, pattern_len);
+    for (size_t n = pattern_len; n < window.size(); n *= 2) {
+        memcpy(&window[n], &window[0], min(n, window.size() - n));
+    }
+    
+    if (node->chunk_map) {
+        for (uint64_t start = 0; start < node->size; start += span) {
+            string plain(&window[start % pattern_len], min(span, node->size - start));
+            if (!store_chunk(inst, node, start / span, plain)) return false;
+        }
+        return true;
+    }
+    
+    if (!claim_blocks_under(inst, node, 0, node->size)) return false;
+    vector<uint32_t> blocks = inst->free_space.get_file_blocks(node->start_block);
+    vector<DataChunk> chunks;
+    for (size_t i = 0; i < blocks.size(); i++) {
+        uint64_t start = static_cast<uint64_t>(i) * block_size;
+        if (start >= node->size) break;
+        size_t length = min<uint64_t>(block_size, node->size - start);
+        uint64_t offset = inst->get_data_offset() + static_cast<uint64_t>(blocks[i]) * block_size;
+        chunks.push_back({offset, &window[start % pattern_len], length});
+    }
+    return data_io_chunks(inst, chunks, true);
+}
+
+// Sets the file's length: shrinking releases the blocks past the new end,
+// growing adds holes that read back as zeros. Either way the cost is in the
+// blocks that change, not the size of the file.
+int file_truncate(void* session, const char* path, uint64_t new_length) {
+    if (!session || !path) {
         return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
     }
+    
+    Session* sess = static_cast<Session*>(session);
+    OMNIInstance* inst = sess->instance;
+    SharedLock lock(&inst->fs_lock);
+    
+    PathLocks locks;
+    FSNode* node = inst->file_system.lock_path(path, locks, LockMode::EXCLUSIVE);
+    if (!node) {
+        return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+    }
+    
+    if (node->type != EntryType::FILE) {
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    }
+    
+    if (node->owner != sess->user->username && sess->user->role != UserRole::ADMIN) {
+        return static_cast<int>(OFSErrorCodes::ERROR_PERMISSION_DENIED);
+    }
+    
+    // Holes cost no space, but a file can never be longer than the data area
+    uint64_t old_size = node->size;
+    FileSystem::QuotaHold quota;
+    if (new_length > old_size && (new_length > inst->header.total_size - inst->get_data_offset() ||
+        !inst->file_system.reserve_quota(node, new_length - old_size, inst->header.user_quota, quota))) {
+        return static_cast<int>(OFSErrorCodes::ERROR_NO_SPACE);
+    }
+    
+    Change change{ChangeKind::FILE_EDITED, path, "", min(new_length, old_size), "", "", 0, old_size};
+    if (sess->change_log && new_length < old_size) {
+        change.data.resize(old_size - new_length);
+        if (!read_file_data(inst, node, new_length, &change.data[0], change.data.size())) {
+            return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+        }
+        // Trailing zeros come back as holes when the length is restored
+        change.data.erase(change.data.find_last_not_of('\0') + 1);
+    }
+    
+    if (new_length > old_size && !zero_tail(inst, node, old_size, new_length)) {
+        return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+    }
+    if (!set_file_length(inst, node, new_length)) {
+        return static_cast<int>(OFSErrorCodes::ERROR_NO_SPACE);
+    }
+    record_change(sess, std::move(change));
+    
+    node->modified_time = time(nullptr);
+    
+    cout << "✓ File truncated: " << path << " (" << old_size << " -> " << new_length << " bytes)\n";
+    sess->operations_count++;
+    sess->last_activity = time(nullptr);
+    
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
 
+// Overwrites the whole file with the "siruamr" pattern
+int file_truncate(void* session, const char* path) {
+    if (!session || !path) {
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    }
+    
     Session* sess = static_cast<Session*>(session);
     OMNIInstance* inst = sess->instance;
+    SharedLock lock(&inst->fs_lock);
+    
+    PathLocks locks;
+    FSNode* node = inst->file_system.lock_path(path, locks, LockMode::EXCLUSIVE);
+    if (!node) {
+        return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+    }
+    
+    if (node->type != EntryType::FILE) {
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    }
+    
+    if (node->owner != sess->user->username && sess->user->role != UserRole::ADMIN) {
+        return static_cast<int>(OFSErrorCodes::ERROR_PERMISSION_DENIED);
+    }
+    
+    if (sess->change_log) {
+        Change change{ChangeKind::FILE_EDITED, path, "", 0, string(node->size, '\0'), "", 0, node->size};
+        if (node->size > 0 && !read_file_data(inst, node, 0, &change.data[0], node->size)) {
+            return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+        }
+        record_change(sess, std::move(change));
+    }
+    
+    if (node->size > 0 && !fill_pattern(inst, node, "siruamr")) {
+        return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+    }
+    
+    node->modified_time = time(nullptr);
+    
+    cout << "✓ File truncated: " << path << "\n";
+    sess->operations_count++;
+    sess->last_activity = time(nullptr);
+    
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
 
-    FSNode* node = inst->file_system.find_node(path);
+int file_exists(void* session, const char* path) {
+    if (!session || !path) {
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    }
+    
+    Session* sess = static_cast<Session*>(session);
+    OMNIInstance* inst = sess->instance;
+    SharedLock lock(&inst->fs_lock);
+    
+    PathLocks locks;
+    FSNode* node = inst->file_system.lookup(path, locks);
+    if (!node || node->type != EntryType::FILE) {
+        return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+    }
+    
+    sess->operations_count++;
+    sess->last_activity = time(nullptr);
+    
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+int file_rename(void* session, const char* old_path, const char* new_path) {
+    if (!session || !old_path || !new_path) {
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    }
+    
+    Session* sess = static_cast<Session*>(session);
+    OMNIInstance* inst = sess->instance;
+    SharedLock lock(&inst->fs_lock);
+    
+    PathLocks locks;
+    FSNode* new_parent = nullptr;
+    string new_name;
+    FSNode* node = inst->file_system.lock_for_move(old_path, new_path, locks, new_parent, new_name);
+    if (!node) {
+        return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+    }
+    
+    if (new_parent && new_parent->find_child(new_name)) {
+        return static_cast<int>(OFSErrorCodes::ERROR_FILE_EXISTS);
+    }
+    
+    if (node->owner != sess->user->username && sess->user->role != UserRole::ADMIN) {
+        return static_cast<int>(OFSErrorCodes::ERROR_PERMISSION_DENIED);
+    }
+    
+    // Moving into another home directory counts against that home's quota
+    uint64_t moved_bytes = node->type == EntryType::DIRECTORY ? node->subtree_bytes.load() : node->size;
+    if (new_parent && inst->file_system.home_of(new_parent) != inst->file_system.home_of(node) &&
+        !inst->file_system.home_has_room(new_parent, moved_bytes, inst->header.user_quota)) {
+        return static_cast<int>(OFSErrorCodes::ERROR_NO_SPACE);
+    }
+    
+    if (!inst->file_system.move_node(node, new_parent, new_name)) {
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_PATH);
+    }
+    
+    node->modified_time = time(nullptr);
+    
+    record_change(sess, Change{ChangeKind::FILE_RENAMED, new_path, old_path, 0, "", "", 0, 0});
+    
+    cout << "✓ File renamed: " << old_path << " -> " << new_path << "\n";
+    sess->operations_count++;
+    sess->last_activity = time(nullptr);
+    
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+int dir_create(void* session, const char* path) {
+    if (!session || !path) {
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    }
+    
+    Session* sess = static_cast<Session*>(session);
+    OMNIInstance* inst = sess->instance;
+    SharedLock lock(&inst->fs_lock);
+    
+    PathLocks locks;
+    bool exists = false;
+    FSNode* node = inst->file_system.create_node(path, EntryType::DIRECTORY, sess->user->username, locks, &exists);
+    if (!node) {
+        return static_cast<int>(exists ? OFSErrorCodes::ERROR_FILE_EXISTS : OFSErrorCodes::ERROR_INVALID_PATH);
+    }
+    
+    record_change(sess, Change{ChangeKind::DIR_CREATED, path, "", 0, "", "", 0, 0});
+    
+    cout << "✓ Directory created: " << path << "\n";
+    sess->operations_count++;
+    sess->last_activity = time(nullptr);
+    
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+void fill_file_entry(FileEntry& entry, FSNode* node) {
+    strncpy(entry.name, node->name.c_str(), sizeof(entry.name) - 1);
+    entry.name[sizeof(entry.name) - 1] = '\0';
+
+    entry.type = static_cast<uint8_t>(node->type);
+    entry.size = node->size;
+    entry.permissions = node->permissions;
+    entry.created_time = node->created_time;
+    entry.modified_time = node->modified_time;
+
+    strncpy(entry.owner, node->owner.c_str(), sizeof(entry.owner) - 1);
+    entry.owner[sizeof(entry.owner) - 1] = '\0';
+
+    entry.inode = node->inode;
+    entry.generation = node->generation;
+    memset(entry.reserved, 0, sizeof(entry.reserved));
+}
+
+int dir_list_page(void* session, const char* path, const char* start_after, const char* prefix,
+                  int type_filter, int limit, FileEntry** entries, int* count, bool* has_more) {
+    if (!session || !path || !entries || !count || !has_more) {
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    }
+
+    Session* sess = static_cast<Session*>(session);
+    OMNIInstance* inst = sess->instance;
+    SharedLock lock(&inst->fs_lock);
+
+    // Listing never takes the directory's lock: the page comes from one
+    // published version of the child index, so writers are not held up
+    EpochGuard epoch;
+    FSNode* node = inst->file_system.find_published(path);
     if (!node) {
         return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
     }
@@ -657,9 +1621,10 @@ int dir_list(void* session, const char* path, FileEntry** entries, int* count) {
         return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
     }
 
-    // ✅ Collect all children using inorder traversal
+    // Only the requested page is collected; limit <= 0 means the whole directory
     std::vector<FSNode*> children;
-    node->children.inorder_collect(node->children.getRoot(),children);
+    *has_more = node->children.collect_page(start_after ? start_after : "", prefix ? prefix : "",
+                                            type_filter, limit > 0 ? limit : 0, children);
 
     int num_children = children.size();
     FileEntry* entry_array = (FileEntry*)malloc(num_children * sizeof(FileEntry));
@@ -668,22 +1633,8 @@ int dir_list(void* session, const char* path, FileEntry** entries, int* count) {
     }
 
     for (int i = 0; i < num_children; i++) {
-        FSNode* child = children[i];
-
-        strncpy(entry_array[i].name, child->name.c_str(), sizeof(entry_array[i].name) - 1);
-        entry_array[i].name[sizeof(entry_array[i].name) - 1] = '\0';
-
-        entry_array[i].type = static_cast<uint8_t>(child->type);
-        entry_array[i].size = child->size;
-        entry_array[i].permissions = child->permissions;
-        entry_array[i].created_time = child->created_time;
-        entry_array[i].modified_time = child->modified_time;
-
-        strncpy(entry_array[i].owner, child->owner.c_str(), sizeof(entry_array[i].owner) - 1);
-        entry_array[i].owner[sizeof(entry_array[i].owner) - 1] = '\0';
-
-        entry_array[i].inode = child->inode;
-        memset(entry_array[i].reserved, 0, sizeof(entry_array[i].reserved));
+        SharedLock child_lock(&children[i]->lock);
+        fill_file_entry(entry_array[i], children[i]);
     }
 
     *entries = entry_array;
@@ -696,7 +1647,10 @@ int dir_list(void* session, const char* path, FileEntry** entries, int* count) {
     return static_cast<int>(OFSErrorCodes::SUCCESS);
 }
 
-
+int dir_list(void* session, const char* path, FileEntry** entries, int* count) {
+    bool has_more = false;
+    return dir_list_page(session, path, nullptr, nullptr, -1, 0, entries, count, &has_more);
+}
 
 int dir_delete(void* session, const char* path) {
     if (!session || !path) {
@@ -705,8 +1659,10 @@ int dir_delete(void* session, const char* path) {
     
     Session* sess = static_cast<Session*>(session);
     OMNIInstance* inst = sess->instance;
+    SharedLock lock(&inst->fs_lock);
     
-    FSNode* node = inst->file_system.find_node(path);
+    PathLocks locks;
+    FSNode* node = inst->file_system.lock_path(path, locks, LockMode::EXCLUSIVE, LockMode::EXCLUSIVE);
     if (!node) {
         return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
     }
@@ -723,10 +1679,13 @@ int dir_delete(void* session, const char* path) {
         return static_cast<int>(OFSErrorCodes::ERROR_PERMISSION_DENIED);
     }
     
-    if (!inst->file_system.delete_node(path)) {
+    if (node == inst->file_system.get_root()) {
         return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
     }
     
+    record_change(sess, Change{ChangeKind::DIR_DELETED, path, "", 0, "", node->owner, node->permissions, 0});
+    inst->file_system.unlink_node(node, locks);
+    
     cout << "✓ Directory deleted: " << path << "\n";
     sess->operations_count++;
     sess->last_activity = time(nullptr);
@@ -734,6 +1693,44 @@ int dir_delete(void* session, const char* path) {
     return static_cast<int>(OFSErrorCodes::SUCCESS);
 }
 
+int dir_delete_recursive(void* session, const char* path) {
+    if (!session || !path) {
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    }
+    
+    Session* sess = static_cast<Session*>(session);
+    OMNIInstance* inst = sess->instance;
+    SharedLock lock(&inst->fs_lock);
+    
+    PathLocks locks;
+    FSNode* node = inst->file_system.lock_path(path, locks, LockMode::EXCLUSIVE, LockMode::EXCLUSIVE);
+    if (!node) {
+        return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+    }
+    
+    if (node->type != EntryType::DIRECTORY || node == inst->file_system.get_root()) {
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    }
+    
+    inst->file_system.lock_subtree(node, locks);
+    
+    if (sess->user->role != UserRole::ADMIN && !inst->file_system.subtree_owned_by(node, sess->user->username)) {
+        return static_cast<int>(OFSErrorCodes::ERROR_PERMISSION_DENIED);
+    }
+    
+    vector<uint32_t> freed_allocations;
+    uint32_t removed = inst->file_system.delete_subtree(node, locks, freed_allocations);
+    if (!freed_allocations.empty()) {
+        inst->free_space.free_many(freed_allocations);
+    }
+    
+    cout << "✓ Directory deleted recursively: " << path << " (" << removed << " entries)\n";
+    sess->operations_count++;
+    sess->last_activity = time(nullptr);
+    
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
 int dir_exists(void* session, const char* path) {
     if (!session || !path) {
         return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
@@ -741,8 +1738,10 @@ int dir_exists(void* session, const char* path) {
     
     Session* sess = static_cast<Session*>(session);
     OMNIInstance* inst = sess->instance;
+    SharedLock lock(&inst->fs_lock);
     
-    FSNode* node = inst->file_system.find_node(path);
+    PathLocks locks;
+    FSNode* node = inst->file_system.lookup(path, locks);
     if (!node || node->type != EntryType::DIRECTORY) {
         return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
     }
@@ -754,25 +1753,191 @@ int dir_exists(void* session, const char* path) {
 }
 
 
+void count_files_recursive(FSNode* node, uint32_t& files, uint32_t& dirs, uint64_t& total_size);
+
+// Atomic batches: between change_log_begin and change_log_commit every
+// successful mutation on the session records how to undo itself (edits and
+// deletes keep the bytes they destroy), and change_log_rollback replays those
+// records newest first. Only the operations that record can be undone, so
+// the caller keeps anything else out of an atomic batch. Other sessions see
+// each step as it lands; this is all-or-nothing, not isolation.
+int change_log_begin(void* session) {
+    if (!session) {
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    }
+    Session* sess = static_cast<Session*>(session);
+    if (sess->change_log) {
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    }
+    sess->change_log = new ChangeLog();
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+size_t change_log_size(void* session) {
+    Session* sess = static_cast<Session*>(session);
+    return sess && sess->change_log ? sess->change_log->changes.size() : 0;
+}
+
+int change_log_commit(void* session) {
+    if (!session) {
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    }
+    Session* sess = static_cast<Session*>(session);
+    delete sess->change_log;
+    sess->change_log = nullptr;
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+// Puts back the bytes an edit overwrote and the length the file had before
+int restore_edit(Session* sess, const Change& change) {
+    OMNIInstance* inst = sess->instance;
+    SharedLock lock(&inst->fs_lock);
+    
+    PathLocks locks;
+    FSNode* node = inst->file_system.lock_path(change.path, locks, LockMode::EXCLUSIVE);
+    if (!node || node->type != EntryType::FILE) {
+        return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+    }
+    // A shrink is undone by growing back first and rewriting what it cut off
+    if (node->size < change.old_size) {
+        if (!zero_tail(inst, node, node->size, change.old_size)) {
+            return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+        }
+        if (!set_file_length(inst, node, change.old_size)) {
+            return static_cast<int>(OFSErrorCodes::ERROR_NO_SPACE);
+        }
+    }
+    if (!change.data.empty() && !write_file_data(inst, node, change.offset, change.data.data(), change.data.size())) {
+        return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+    }
+    if (node->size > change.old_size && !set_file_length(inst, node, change.old_size)) {
+        return static_cast<int>(OFSErrorCodes::ERROR_NO_SPACE);
+    }
+    node->modified_time = time(nullptr);
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+int restore_dir(Session* sess, const Change& change) {
+    OMNIInstance* inst = sess->instance;
+    SharedLock lock(&inst->fs_lock);
+    
+    PathLocks locks;
+    bool exists = false;
+    FSNode* node = inst->file_system.create_node(change.path, EntryType::DIRECTORY, change.owner, locks, &exists);
+    if (!node) {
+        return static_cast<int>(exists ? OFSErrorCodes::ERROR_FILE_EXISTS : OFSErrorCodes::ERROR_INVALID_PATH);
+    }
+    node->permissions = change.permissions;
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+// Undoes everything recorded since change_log_begin and ends the batch. Keeps
+// going past a step that fails (another session may have changed the path
+// meanwhile) and returns the first error.
+int change_log_rollback(void* session) {
+    if (!session) {
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    }
+    Session* sess = static_cast<Session*>(session);
+    ChangeLog* log = sess->change_log;
+    sess->change_log = nullptr;
+    if (!log) {
+        return static_cast<int>(OFSErrorCodes::SUCCESS);
+    }
+    
+    int first_error = static_cast<int>(OFSErrorCodes::SUCCESS);
+    for (auto it = log->changes.rbegin(); it != log->changes.rend(); ++it) {
+        const Change& change = *it;
+        int result = static_cast<int>(OFSErrorCodes::SUCCESS);
+        switch (change.kind) {
+            case ChangeKind::FILE_CREATED:
+                result = file_delete(sess, change.path.c_str());
+                break;
+            case ChangeKind::FILE_EDITED:
+                result = restore_edit(sess, change);
+                break;
+            case ChangeKind::FILE_DELETED:
+                result = create_file(sess, change.path.c_str(), change.data.data(), change.data.size(), &change);
+                break;
+            case ChangeKind::FILE_RENAMED:
+                result = file_rename(sess, change.path.c_str(), change.old_path.c_str());
+                break;
+            case ChangeKind::DIR_CREATED:
+                result = dir_delete(sess, change.path.c_str());
+                break;
+            case ChangeKind::DIR_DELETED:
+                result = restore_dir(sess, change);
+                break;
+        }
+        if (result != static_cast<int>(OFSErrorCodes::SUCCESS) && first_error == static_cast<int>(OFSErrorCodes::SUCCESS)) {
+            first_error = result;
+        }
+    }
+    
+    if (first_error == static_cast<int>(OFSErrorCodes::SUCCESS)) {
+        cout << "✓ Rolled back " << log->changes.size() << " changes\n";
+    } else {
+        cout << "✗ Rollback incomplete (error " << first_error << ")\n";
+    }
+    delete log;
+    return first_error;
+}
+
+void count_children_recursive(AVLFSNode* child, uint32_t& files, uint32_t& dirs, uint64_t& total_size) {
+    if (!child) return;
+    count_children_recursive(child->left, files, dirs, total_size);
+    count_files_recursive(child->fs_node, files, dirs, total_size);
+    count_children_recursive(child->right, files, dirs, total_size);
+}
+
 void count_files_recursive(FSNode* node, uint32_t& files, uint32_t& dirs, uint64_t& total_size) {
     if (!node) return;
 
     if (node->type == EntryType::DIRECTORY) {
         dirs++;
-
-        // Collect children from AVL tree
-        std::vector<FSNode*> children;
-        node->children.inorder_collect(node->children.getRoot(),children);  // Assuming 'children_root' is your AVL root
-
-        for (auto* child : children) {
-            count_files_recursive(child, files, dirs, total_size);
-        }
+        count_children_recursive(node->children.getRoot(), files, dirs, total_size);
     } else {
         files++;
         total_size += node->size;
     }
 }
 
+#ifdef OFS_DEBUG_STATS
+// Debug builds (-DOFS_DEBUG_STATS) re-walk the tree on every get_stats and
+// report any drift between the incremental counters and the real state.
+void verify_stats_counters(OMNIInstance* inst) {
+    uint32_t total_files = 0;
+    uint32_t total_dirs = 0;
+    uint64_t used_size = 0;
+    
+    count_files_recursive(inst->file_system.get_root(), total_files, total_dirs, used_size);
+    total_dirs = total_dirs > 0 ? total_dirs - 1 : 0;
+    
+    // A shared block counts once for every file holding it
+    uint64_t used_blocks = inst->free_space.get_total_blocks() - inst->free_space.get_free_blocks() +
+                           inst->free_space.get_shared_refs();
+    
+    FSNode* root = inst->file_system.get_root();
+    if (root->subtree_files != total_files || root->subtree_dirs != total_dirs ||
+        root->subtree_bytes != used_size || root->subtree_blocks != used_blocks) {
+        cout << "✗ Stats counters drifted: files " << root->subtree_files << "/" << total_files
+             << ", dirs " << root->subtree_dirs << "/" << total_dirs
+             << ", bytes " << root->subtree_bytes << "/" << used_size
+             << ", blocks " << root->subtree_blocks << "/" << used_blocks << "\n";
+    }
+}
+#endif
+
+void fill_metadata(OMNIInstance* inst, FSNode* node, const string& path, FileMetadata* meta) {
+    strncpy(meta->path, path.c_str(), sizeof(meta->path) - 1);
+    meta->path[sizeof(meta->path) - 1] = '\0';
+    
+    fill_file_entry(meta->entry, node);
+    meta->blocks_used = node->num_blocks;
+    meta->actual_size = node->num_blocks * inst->header.block_size;
+    
+    memset(meta->reserved, 0, sizeof(meta->reserved));
+}
 
 int get_metadata(void* session, const char* path, FileMetadata* meta) {
     if (!session || !path || !meta) {
@@ -781,33 +1946,39 @@ int get_metadata(void* session, const char* path, FileMetadata* meta) {
     
     Session* sess = static_cast<Session*>(session);
     OMNIInstance* inst = sess->instance;
+    SharedLock lock(&inst->fs_lock);
     
-    FSNode* node = inst->file_system.find_node(path);
+    PathLocks locks;
+    FSNode* node = inst->file_system.lookup(path, locks);
     if (!node) {
         return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
     }
     
-    strncpy(meta->path, path, sizeof(meta->path) - 1);
-    meta->path[sizeof(meta->path) - 1] = '\0';
+    fill_metadata(inst, node, path, meta);
     
-    strncpy(meta->entry.name, node->name.c_str(), sizeof(meta->entry.name) - 1);
-    meta->entry.name[sizeof(meta->entry.name) - 1] = '\0';
+    sess->operations_count++;
+    sess->last_activity = time(nullptr);
     
-    meta->entry.type = static_cast<uint8_t>(node->type);
-    meta->entry.size = node->size;
-    meta->entry.permissions = node->permissions;
-    meta->entry.created_time = node->created_time;
-    meta->entry.modified_time = node->modified_time;
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+int stat_by_inode(void* session, uint32_t inode, uint32_t generation, FileMetadata* meta) {
+    if (!session || !meta) {
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    }
     
-    strncpy(meta->entry.owner, node->owner.c_str(), sizeof(meta->entry.owner) - 1);
-    meta->entry.owner[sizeof(meta->entry.owner) - 1] = '\0';
+    Session* sess = static_cast<Session*>(session);
+    OMNIInstance* inst = sess->instance;
+    SharedLock lock(&inst->fs_lock);
     
-    meta->entry.inode = node->inode;
-    meta->blocks_used = node->num_blocks;
-    meta->actual_size = node->num_blocks * inst->header.block_size;
+    PathLocks locks;
+    inst->file_system.hold_names(locks);
+    FSNode* node = inst->file_system.lock_inode(inode, generation, locks, LockMode::SHARED);
+    if (!node) {
+        return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+    }
     
-    memset(meta->entry.reserved, 0, sizeof(meta->entry.reserved));
-    memset(meta->reserved, 0, sizeof(meta->reserved));
+    fill_metadata(inst, node, node->full_path(), meta);
     
     sess->operations_count++;
     sess->last_activity = time(nullptr);
@@ -822,8 +1993,10 @@ int set_permissions(void* session, const char* path, uint32_t permissions) {
     
     Session* sess = static_cast<Session*>(session);
     OMNIInstance* inst = sess->instance;
+    SharedLock lock(&inst->fs_lock);
     
-    FSNode* node = inst->file_system.find_node(path);
+    PathLocks locks;
+    FSNode* node = inst->file_system.lock_path(path, locks, LockMode::EXCLUSIVE);
     if (!node) {
         return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
     }
@@ -842,6 +2015,42 @@ int set_permissions(void* session, const char* path, uint32_t permissions) {
     return static_cast<int>(OFSErrorCodes::SUCCESS);
 }
 
+// Sets whether files created below a directory are stored compressed; files
+// already there keep the layout they were created with
+int dir_set_compression(void* session, const char* path, CompressionPolicy policy) {
+    if (!session || !path) {
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    }
+    
+    Session* sess = static_cast<Session*>(session);
+    OMNIInstance* inst = sess->instance;
+    SharedLock lock(&inst->fs_lock);
+    
+    PathLocks locks;
+    FSNode* node = inst->file_system.lock_path(path, locks, LockMode::EXCLUSIVE);
+    if (!node) {
+        return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+    }
+    
+    if (node->type != EntryType::DIRECTORY) {
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    }
+    
+    if (node->owner != sess->user->username && sess->user->role != UserRole::ADMIN) {
+        return static_cast<int>(OFSErrorCodes::ERROR_PERMISSION_DENIED);
+    }
+    
+    node->compression = policy;
+    node->modified_time = time(nullptr);
+    
+    cout << "✓ Compression set: " << path << " ("
+         << (policy == CompressionPolicy::ON ? "on" : policy == CompressionPolicy::OFF ? "off" : "inherit") << ")\n";
+    sess->operations_count++;
+    sess->last_activity = time(nullptr);
+    
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
 int get_stats(void* session, FSStats* stats) {
     if (!session || !stats) {
         return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
@@ -849,18 +2058,21 @@ int get_stats(void* session, FSStats* stats) {
     
     Session* sess = static_cast<Session*>(session);
     OMNIInstance* inst = sess->instance;
+#ifdef OFS_DEBUG_STATS
+    // The verification walk reads the whole tree, so it needs it quiescent
+    ExclusiveLock lock(&inst->fs_lock);
+    verify_stats_counters(inst);
+#else
+    SharedLock lock(&inst->fs_lock);
+#endif
     
-    uint32_t total_files = 0;
-    uint32_t total_dirs = 0;
-    uint64_t used_size = 0;
-    
-    count_files_recursive(inst->file_system.get_root(), total_files, total_dirs, used_size);
+    FSNode* root = inst->file_system.get_root();
     
     stats->total_size = inst->header.total_size;
-    stats->used_space = used_size;
+    stats->used_space = root->subtree_bytes;
     stats->free_space = inst->free_space.get_free_blocks() * inst->header.block_size;
-    stats->total_files = total_files;
-    stats->total_directories = total_dirs > 0 ? total_dirs - 1 : 0;
+    stats->total_files = root->subtree_files;
+    stats->total_directories = root->subtree_dirs;
     stats->total_users = inst->user_system.get_user_count();
     stats->active_sessions = inst->sessions.size();
     
@@ -869,6 +2081,22 @@ int get_stats(void* session, FSStats* stats) {
     stats->fragmentation = (total_blocks > 0) ? 
         (static_cast<double>(used_blocks) / total_blocks * 100.0) : 0.0;
     
+    // Shared blocks (dedup, file_copy) are held more than once but stored once
+    uint64_t held_blocks = used_blocks + inst->free_space.get_shared_refs();
+    stats->dedup_ratio = used_blocks > 0 ? static_cast<double>(held_blocks) / used_blocks : 1.0;
+    stats->dedup_index_entries = inst->free_space.get_indexed_blocks();
+    stats->dedup_index_bytes = inst->free_space.get_index_memory_size();
+    
+    // Codec figures are totals since startup; chunks later overwritten or
+    // deleted still count towards the ratio
+    const CodecCounters& codec = inst->codec;
+    stats->compression_ratio = codec.stored_packed > 0 ?
+        static_cast<double>(codec.stored_raw) / codec.stored_packed : 1.0;
+    stats->compress_mb_per_sec = codec.compress_ns > 0 ?
+        static_cast<double>(codec.compressed_bytes) / codec.compress_ns * 1000.0 : 0.0;
+    stats->decompress_mb_per_sec = codec.decompress_ns > 0 ?
+        static_cast<double>(codec.decompressed_bytes) / codec.decompress_ns * 1000.0 : 0.0;
+    
     memset(stats->reserved, 0, sizeof(stats->reserved));
     
     sess->operations_count++;
@@ -877,6 +2105,56 @@ int get_stats(void* session, FSStats* stats) {
     return static_cast<int>(OFSErrorCodes::SUCCESS);
 }
 
+int dir_usage(void* session, const char* path, DirUsage* usage) {
+    if (!session || !path || !usage) {
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    }
+    
+    Session* sess = static_cast<Session*>(session);
+    OMNIInstance* inst = sess->instance;
+    SharedLock lock(&inst->fs_lock);
+    
+    PathLocks locks;
+    FSNode* node = inst->file_system.lookup(path, locks);
+    if (!node) {
+        return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+    }
+    
+    if (node->type != EntryType::DIRECTORY) {
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    }
+    
+    *usage = DirUsage(node->subtree_bytes, node->subtree_blocks, node->subtree_files, node->subtree_dirs);
+    
+    sess->operations_count++;
+    sess->last_activity = time(nullptr);
+    
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+int get_user_usage(void* session, const char* username, uint64_t* bytes, uint32_t* files) {
+    if (!session || !username || !bytes || !files) {
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    }
+    
+    Session* sess = static_cast<Session*>(session);
+    OMNIInstance* inst = sess->instance;
+    SharedLock lock(&inst->fs_lock);
+    
+    if (strcmp(sess->user->username, username) != 0 && sess->user->role != UserRole::ADMIN) {
+        return static_cast<int>(OFSErrorCodes::ERROR_PERMISSION_DENIED);
+    }
+    
+    UserUsage usage = inst->file_system.get_user_usage(username);
+    *bytes = usage.bytes;
+    *files = usage.files;
+    
+    sess->operations_count++;
+    sess->last_activity = time(nullptr);
+    
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
 void free_buffer(void* buffer) {
     if (buffer) {
         free(buffer);
@@ -909,6 +2187,10 @@ const char* get_error_message(int error_code) {
             return "Directory not empty";
         case OFSErrorCodes::ERROR_INVALID_OPERATION:
             return "Invalid operation";
+        case OFSErrorCodes::ERROR_SERVER_BUSY:
+            return "Server busy, request rejected";
+        case OFSErrorCodes::ERROR_TIMEOUT:
+            return "Request timed out in queue";
         default:
             return "Unknown error";
     }
@@ -2,14 +2,23 @@
 #include <string>
 #include <cstring>
 #include <sys/socket.h>
+#include <sys/epoll.h>
 #include <netinet/in.h>
 #include <unistd.h>
 #include <map>
+#include <set>
+#include <deque>
 #include <sstream>
 #include <fstream>
 #include <pthread.h>
+#include <sched.h>
+#include <thread>
+#include <chrono>
+#include <atomic>
 #include "file_system.cpp"
-#include "BoundedBlockingQueue.hpp"
+#include "SessionScheduler.hpp"
+#include "BinaryProtocol.hpp"
+#include "Base64.hpp"
 
 using namespace std;
 
@@ -20,41 +29,252 @@ pthread_mutex_t sessions_mutex = PTHREAD_MUTEX_INITIALIZER;
 struct ClientRequest {
     int client_fd;
     string request_data;
+    chrono::steady_clock::time_point arrived;
     
     ClientRequest() : client_fd(-1) {}
-    ClientRequest(int fd, const string& data) : client_fd(fd), request_data(data) {}
+    ClientRequest(int fd, string data)
+        : client_fd(fd), request_data(move(data)), arrived(chrono::steady_clock::now()) {}
 };
 
-BoundedBlockingQueue<ClientRequest>* request_queue = nullptr;
+// [server] section of the .uconf; positional arguments override port
+struct ServerConfig {
+    int port = 8080;
+    int max_connections = 0;  // 0 = unlimited
+    int queue_timeout = 30;   // seconds, 0 = never expire
+};
+
+// Time spent waiting in the queue and time spent executing are kept apart so
+// overload (growing wait) can be told from slow operations (growing exec)
+// Log-linear buckets: four per power of two, so a percentile read back is
+// within ~20% of the true value; recording is one relaxed increment
+struct LatencyHistogram {
+    static const int BUCKETS = 4 * 40;
+    atomic<uint64_t> counts[BUCKETS];
+    atomic<uint64_t> total{0};
+    
+    LatencyHistogram() {
+        for (int i = 0; i < BUCKETS; i++) counts[i].store(0, memory_order_relaxed);
+    }
+    
+    static int bucket_of(uint64_t us) {
+        if (us < 4) return static_cast<int>(us);
+        int msb = 63 - __builtin_clzll(us);
+        int b = msb * 4 + static_cast<int>((us >> (msb - 2)) & 3);
+        return b < BUCKETS ? b : BUCKETS - 1;
+    }
+    
+    static uint64_t upper_bound_of(int b) {
+        if (b < 4) return static_cast<uint64_t>(b);
+        int msb = b / 4;
+        return ((4ULL + (b % 4) + 1) << (msb - 2)) - 1;
+    }
+    
+    void record(uint64_t us) {
+        counts[bucket_of(us)].fetch_add(1, memory_order_relaxed);
+        total.fetch_add(1, memory_order_relaxed);
+    }
+    
+    uint64_t percentile(double p) {
+        uint64_t n = total.load(memory_order_relaxed);
+        if (n == 0) return 0;
+        uint64_t rank = static_cast<uint64_t>(p * n);
+        if (rank >= n) rank = n - 1;
+        uint64_t seen = 0;
+        for (int b = 0; b < BUCKETS; b++) {
+            seen += counts[b].load(memory_order_relaxed);
+            if (seen > rank) return upper_bound_of(b);
+        }
+        return upper_bound_of(BUCKETS - 1);
+    }
+};
+
+// Scheduling classes, most latency-sensitive first. The operation table puts
+// session/admin calls and metadata reads in INTERACTIVE; any request whose
+// payload is over BULK_PAYLOAD_BYTES, or that walks a whole subtree, is BULK
+enum RequestClass { CLASS_INTERACTIVE = 0, CLASS_STANDARD = 1, CLASS_BULK = 2, CLASS_COUNT = 3 };
+
+#define BULK_PAYLOAD_BYTES 1024
+
+const char* class_names[CLASS_COUNT] = {"interactive", "standard", "bulk"};
+const vector<int> class_weights = {8, 3, 1};
+
+struct ServerStats {
+    atomic<uint64_t> completed{0};
+    atomic<uint64_t> expired{0};
+    atomic<uint64_t> rejected{0};
+    atomic<uint64_t> queue_wait_us{0};
+    atomic<uint64_t> max_queue_wait_us{0};
+    atomic<uint64_t> exec_us{0};
+    atomic<uint64_t> max_exec_us{0};
+    LatencyHistogram class_latency[CLASS_COUNT];  // arrival to response
+};
+
+#define WORKER_BATCH_SIZE 16
+#define WORKER_MAX_IN_FLIGHT 64
+#define REACTOR_WAIT_US 500
+#define QUEUE_HIGH_WATER_PERCENT 90
+#define LISTENER_MAX_EVENTS 64
+#define LISTEN_BACKLOG 128
+#define REQUEST_BUFFER_SIZE 4096
+#define URING_RECV_SLOTS 64
+#define URING_WAITING_MAX 256      // accepted connections queued for a free recv slot
+#define LISTENER_HELD_MAX (URING_RECV_SLOTS + URING_WAITING_MAX)  // the same bound under epoll
+#define RECV_IDLE_TIMEOUT_SEC 5    // a client that sends nothing for this long is dropped
+#define SEND_TIMEOUT_SEC 30        // ...and one that stops reading its response for this long
+#define REQUEST_FRAME_MAX (64 * 1024 * 1024)
+
+SessionScheduler<ClientRequest>* request_scheduler = nullptr;
 bool server_running = true;
+bool pin_workers = false;
+bool session_affinity = true;
+bool use_io_uring = false;
+ServerConfig server_config;
+ServerStats server_stats;
+atomic<int> connections_in_flight(0);
+int queue_high_water = 1;
+
+bool parse_server_config(ServerConfig& config, const string& config_path) {
+    return read_config_entries(config_path, [&](const string& section, const string& key, const string& value) {
+        if (section != "server") return;
+        if (key == "port") config.port = stoi(value);
+        else if (key == "max_connections") config.max_connections = stoi(value);
+        else if (key == "queue_timeout") config.queue_timeout = stoi(value);
+    });
+}
+
+int classify_request(const string& operation, size_t request_size) {
+    static const set<string> interactive = {
+        "init", "login", "logout", "user_create", "user_delete", "user_list",
+        "get_stats", "server_stats", "get_user_usage", "stat_by_inode",
+        "dir_list", "dir_usage"
+    };
+    if (request_size > BULK_PAYLOAD_BYTES || operation == "dir_delete_recursive") return CLASS_BULK;
+    if (interactive.count(operation)) return CLASS_INTERACTIVE;
+    return CLASS_STANDARD;
+}
+
+void record_max(atomic<uint64_t>& slot, uint64_t value) {
+    uint64_t current = slot.load(memory_order_relaxed);
+    while (value > current && !slot.compare_exchange_weak(current, value, memory_order_relaxed)) {}
+}
 
 string json_escape(const string& str) {
+    static const char hex[] = "0123456789abcdef";
     string result;
-    for (char c : str) {
+    result.reserve(str.size());
+    size_t run = 0;
+    for (size_t i = 0; i < str.size(); i++) {
+        unsigned char c = static_cast<unsigned char>(str[i]);
+        if (c >= 0x20 && c != '"' && c != '\\') continue;
+        result.append(str, run, i - run);
+        run = i + 1;
         if (c == '"') result += "\\\"";
         else if (c == '\\') result += "\\\\";
         else if (c == '\n') result += "\\n";
         else if (c == '\r') result += "\\r";
         else if (c == '\t') result += "\\t";
-        else result += c;
+        else {
+            result += "\\u00";
+            result += hex[c >> 4];
+            result += hex[c & 15];
+        }
     }
+    result.append(str, run, string::npos);
     return result;
 }
 
-string get_json_value(const string& json, const string& key) {
+// Bounds of the string value under key: json[begin, end) between the quotes.
+// escaped is set if the value has backslash escapes that still need decoding.
+bool find_json_string(const string& json, const string& key, size_t& begin, size_t& end, bool& escaped) {
     size_t pos = json.find("\"" + key + "\"");
-    if (pos == string::npos) return "";
+    if (pos == string::npos) return false;
     
     pos = json.find(":", pos);
-    if (pos == string::npos) return "";
+    if (pos == string::npos) return false;
     
     pos = json.find("\"", pos);
-    if (pos == string::npos) return "";
+    if (pos == string::npos) return false;
     
-    size_t end = json.find("\"", pos + 1);
-    if (end == string::npos) return "";
-    
-    return json.substr(pos + 1, end - pos - 1);
+    escaped = false;
+    for (end = pos + 1; end < json.length(); end++) {
+        if (json[end] == '"') break;
+        if (json[end] == '\\') {
+            escaped = true;
+            end++;
+        }
+    }
+    if (end >= json.length()) return false;
+    begin = pos + 1;
+    return true;
+}
+
+void append_utf8(string& out, uint32_t cp) {
+    if (cp < 0x80) {
+        out += static_cast<char>(cp);
+    } else if (cp < 0x800) {
+        out += static_cast<char>(0xc0 | (cp >> 6));
+        out += static_cast<char>(0x80 | (cp & 0x3f));
+    } else if (cp < 0x10000) {
+        out += static_cast<char>(0xe0 | (cp >> 12));
+        out += static_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+        out += static_cast<char>(0x80 | (cp & 0x3f));
+    } else {
+        out += static_cast<char>(0xf0 | (cp >> 18));
+        out += static_cast<char>(0x80 | ((cp >> 12) & 0x3f));
+        out += static_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+        out += static_cast<char>(0x80 | (cp & 0x3f));
+    }
+}
+
+// Four hex digits at json[pos], or -1
+int32_t parse_hex4(const string& json, size_t pos) {
+    int32_t value = 0;
+    for (size_t i = pos; i < pos + 4; i++) {
+        char c = json[i];
+        int digit = isdigit(c) ? c - '0' : (c >= 'a' && c <= 'f') ? c - 'a' + 10 : (c >= 'A' && c <= 'F') ? c - 'A' + 10 : -1;
+        if (digit < 0) return -1;
+        value = value * 16 + digit;
+    }
+    return value;
+}
+
+string json_unescape(const string& json, size_t begin, size_t end) {
+    string result;
+    result.reserve(end - begin);
+    for (size_t i = begin; i < end; i++) {
+        if (json[i] != '\\' || i + 1 >= end) {
+            result += json[i];
+            continue;
+        }
+        char c = json[++i];
+        if (c == 'n') result += '\n';
+        else if (c == 'r') result += '\r';
+        else if (c == 't') result += '\t';
+        else if (c == 'b') result += '\b';
+        else if (c == 'f') result += '\f';
+        else if (c == 'u' && i + 4 < end && parse_hex4(json, i + 1) >= 0) {
+            uint32_t cp = parse_hex4(json, i + 1);
+            i += 4;
+            // Surrogate pair for characters outside the BMP
+            if (cp >= 0xd800 && cp < 0xdc00 && i + 6 < end && json[i + 1] == '\\' && json[i + 2] == 'u') {
+                int32_t low = parse_hex4(json, i + 3);
+                if (low >= 0xdc00 && low < 0xe000) {
+                    cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+                    i += 6;
+                }
+            }
+            append_utf8(result, cp);
+        }
+        else result += c;  // \" \\ \/
+    }
+    return result;
+}
+
+string get_json_value(const string& json, const string& key) {
+    size_t begin, end;
+    bool escaped;
+    if (!find_json_string(json, key, begin, end, escaped)) return "";
+    return escaped ? json_unescape(json, begin, end) : json.substr(begin, end - begin);
 }
 
 int get_json_int(const string& json, const string& key) {
@@ -74,6 +294,251 @@ int get_json_int(const string& json, const string& key) {
     return num.empty() ? 0 : stoi(num);
 }
 
+// A non-negative 64-bit number under key (0 when the key is missing); false
+// if the value is negative, not a number or too large, rather than throwing
+bool get_json_uint64(const string& json, const string& key, uint64_t& value) {
+    value = 0;
+    size_t pos = json.find("\"" + key + "\"");
+    if (pos == string::npos) return true;
+    
+    pos = json.find(":", pos);
+    if (pos == string::npos) return true;
+    
+    while (pos < json.length() && (json[pos] == ':' || json[pos] == ' ')) pos++;
+    if (pos >= json.length() || !isdigit(json[pos])) return false;
+    
+    errno = 0;
+    char* end = nullptr;
+    value = strtoull(json.c_str() + pos, &end, 10);
+    return errno != ERANGE;
+}
+
+bool get_json_bool(const string& json, const string& key) {
+    size_t pos = json.find("\"" + key + "\"");
+    if (pos == string::npos) return false;
+    
+    pos = json.find(":", pos);
+    if (pos == string::npos) return false;
+    
+    while (pos < json.length() && (json[pos] == ':' || json[pos] == ' ')) pos++;
+    return json.compare(pos, 4, "true") == 0 || (pos < json.length() && json[pos] >= '1' && json[pos] <= '9');
+}
+
+// Raw text of each object in the array under key
+vector<string> get_json_objects(const string& json, const string& key) {
+    vector<string> objects;
+    size_t pos = json.find("\"" + key + "\"");
+    if (pos == string::npos) return objects;
+    
+    pos = json.find("[", pos);
+    if (pos == string::npos) return objects;
+    
+    int depth = 0;
+    bool in_string = false;
+    size_t start = 0;
+    for (pos++; pos < json.length(); pos++) {
+        char c = json[pos];
+        if (in_string) {
+            if (c == '\\') pos++;
+            else if (c == '"') in_string = false;
+        }
+        else if (c == '"') in_string = true;
+        else if (c == '{' && depth++ == 0) start = pos;
+        else if (c == '}' && --depth == 0) objects.push_back(json.substr(start, pos - start + 1));
+        else if (c == ']' && depth == 0) break;
+    }
+    return objects;
+}
+
+// Parameters of one request in either protocol. JSON parameters stay as the
+// raw object and are looked up on demand; binary fields arrive typed and are
+// decoded once, so content needs no unescaping and numbers no parsing.
+struct RequestParams {
+    bool binary = false;
+    string json;
+    map<string, string> strings;
+    map<string, int64_t> ints;
+    
+    string get(const string& key) const {
+        if (!binary) return get_json_value(json, key);
+        auto it = strings.find(key);
+        return it == strings.end() ? "" : it->second;
+    }
+    
+    int get_int(const string& key) const {
+        if (!binary) return get_json_int(json, key);
+        auto it = ints.find(key);
+        return it == ints.end() ? 0 : static_cast<int>(it->second);
+    }
+    
+    bool get_uint64(const string& key, uint64_t& value) const {
+        if (!binary) return get_json_uint64(json, key, value);
+        auto it = ints.find(key);
+        value = it == ints.end() ? 0 : static_cast<uint64_t>(it->second);
+        return it == ints.end() || it->second >= 0;
+    }
+    
+    bool get_uint32(const string& key, uint32_t& value) const {
+        uint64_t wide;
+        if (!get_uint64(key, wide) || wide > UINT32_MAX) return false;
+        value = static_cast<uint32_t>(wide);
+        return true;
+    }
+    
+    bool get_bool(const string& key) const {
+        if (!binary) return get_json_bool(json, key);
+        return get_int(key) != 0;
+    }
+    
+    // The value in place, without a copy; false if it is missing or, in JSON,
+    // has escapes (get() decodes those)
+    bool get_raw(const string& key, const char*& data, size_t& length) const {
+        if (binary) {
+            auto it = strings.find(key);
+            if (it == strings.end()) return false;
+            data = it->second.data();
+            length = it->second.size();
+            return true;
+        }
+        size_t begin, end;
+        bool escaped;
+        if (!find_json_string(json, key, begin, end, escaped) || escaped) return false;
+        data = json.data() + begin;
+        length = end - begin;
+        return true;
+    }
+};
+
+struct Request {
+    bool binary = false;
+    string operation;
+    string session_id;
+    string request_id;
+    uint8_t opcode = 0;         // binary only
+    uint32_t frame_id = 0;      // binary only: request id as sent
+    RequestParams params;
+};
+
+// Envelope only (operation, session, request id); enough to route, classify
+// or reject a request without decoding its parameters
+Request peek_request(const string& raw) {
+    Request request;
+    if (!is_binary_request(raw)) {
+        request.operation = get_json_value(raw, "operation");
+        request.session_id = get_json_value(raw, "session_id");
+        request.request_id = get_json_value(raw, "request_id");
+        return request;
+    }
+    
+    BinaryRequestHeader header;
+    request.binary = true;
+    if (raw.size() < sizeof(header)) return request;
+    memcpy(&header, raw.data(), sizeof(header));
+    request.opcode = header.opcode;
+    request.frame_id = header.request_id;
+    request.operation = binary_operation_name(header.opcode);
+    request.request_id = to_string(header.request_id);
+    if (raw.size() >= sizeof(header) + header.session_length) {
+        request.session_id.assign(raw, sizeof(header), header.session_length);
+    }
+    return request;
+}
+
+bool parse_json_request(const string& raw, Request& request) {
+    request = peek_request(raw);
+    
+    size_t params_start = raw.find("\"parameters\"");
+    if (params_start != string::npos) {
+        size_t brace_start = raw.find("{", params_start);
+        if (brace_start != string::npos) {
+            int brace_count = 1;
+            size_t pos = brace_start + 1;
+            bool in_string = false;
+            while (pos < raw.length() && brace_count > 0) {
+                if (in_string) {
+                    if (raw[pos] == '\\') pos++;
+                    else if (raw[pos] == '"') in_string = false;
+                }
+                else if (raw[pos] == '"') in_string = true;
+                else if (raw[pos] == '{') brace_count++;
+                else if (raw[pos] == '}') brace_count--;
+                pos++;
+            }
+            if (pos > raw.length()) pos = raw.length();
+            request.params.json = raw.substr(brace_start, pos - brace_start);
+        }
+    }
+    return true;
+}
+
+// False if the frame is truncated, of another version, or its fields overrun
+bool parse_binary_request(const string& raw, Request& request) {
+    BinaryRequestHeader header;
+    if (raw.size() < sizeof(header)) return false;
+    memcpy(&header, raw.data(), sizeof(header));
+    size_t end = sizeof(header) + header.body_length;
+    if (header.version != BINARY_VERSION || raw.size() < end || header.session_length > header.body_length) {
+        return false;
+    }
+    
+    request = peek_request(raw);
+    request.params.binary = true;
+    size_t pos = sizeof(header) + header.session_length;
+    while (pos < end) {
+        if (end - pos < 6) return false;
+        uint8_t id = static_cast<uint8_t>(raw[pos]);
+        uint8_t type = static_cast<uint8_t>(raw[pos + 1]);
+        uint32_t length;
+        memcpy(&length, raw.data() + pos + 2, sizeof(length));
+        pos += 6;
+        if (length > end - pos) return false;
+        
+        const char* name = binary_field_name(id);
+        if (name && type == FIELD_INT && length == sizeof(int64_t)) {
+            int64_t value;
+            memcpy(&value, raw.data() + pos, sizeof(value));
+            request.params.ints[name] = value;
+        } else if (name && (type == FIELD_STRING || type == FIELD_BYTES)) {
+            request.params.strings[name].assign(raw, pos, length);
+        }
+        pos += length;
+    }
+    return true;
+}
+
+// How file content travels in "data" and in read responses: as the string
+// itself, or base64 for arbitrary bytes
+enum ContentEncoding { ENCODING_TEXT, ENCODING_BASE64, ENCODING_INVALID };
+
+ContentEncoding content_encoding(const RequestParams& params) {
+    string encoding = params.get("encoding");
+    if (encoding.empty() || encoding == "text") return ENCODING_TEXT;
+    if (encoding == "base64") return ENCODING_BASE64;
+    return ENCODING_INVALID;
+}
+
+// The "data" parameter as bytes; false if it is not valid base64. Base64 is
+// decoded from the request buffer itself unless the client escaped it.
+bool get_content(const RequestParams& params, string& content) {
+    if (content_encoding(params) != ENCODING_BASE64) {
+        content = params.get("data");
+        return true;
+    }
+    string unescaped;
+    const char* data = nullptr;
+    size_t length = 0;
+    if (!params.get_raw("data", data, length)) {
+        unescaped = params.get("data");
+        data = unescaped.data();
+        length = unescaped.size();
+    }
+    content.resize(base64_decoded_capacity(length));
+    size_t written = 0;
+    if (!base64_decode(data, length, &content[0], written)) return false;
+    content.resize(written);
+    return true;
+}
+
 string create_response(const string& status, const string& operation, const string& request_id, const string& data_json) {
     return "{\"status\":\"" + status + "\",\"operation\":\"" + operation + 
            "\",\"request_id\":\"" + request_id + "\",\"data\":" + data_json + "}";
@@ -85,9 +550,68 @@ string create_error_response(const string& operation, const string& request_id,
            ",\"error_message\":\"" + json_escape(get_error_message(error_code)) + "\"}";
 }
 
-string handle_init(const string& params) {
-    string config_path = get_json_value(params, "config_path");
-    string omni_path = get_json_value(params, "omni_path");
+// Outcome of one request, serialized once its handler coroutine is done in
+// the protocol the request came in
+struct Response {
+    bool binary;
+    string operation;
+    string request_id;
+    uint8_t opcode;
+    uint32_t frame_id;
+    int code;
+    string data_json;
+    string payload;        // raw file content
+    string payload_field;  // key the payload is escaped under in JSON
+    bool payload_base64;   // sent base64-encoded instead
+    
+    static Response error(const Request& request, int code) {
+        return Response{request.binary, request.operation, request.request_id, request.opcode, request.frame_id,
+                        code, "", "", "", false};
+    }
+    
+    static Response success(const Request& request, const string& data_json) {
+        Response response = error(request, static_cast<int>(OFSErrorCodes::SUCCESS));
+        response.data_json = data_json;
+        return response;
+    }
+    
+    string serialize() const {
+        bool ok = code == static_cast<int>(OFSErrorCodes::SUCCESS);
+        if (binary) {
+            if (!ok) return encode_binary_response(opcode, frame_id, code, get_error_message(code), "");
+            return encode_binary_response(opcode, frame_id, code, data_json, payload_base64 ? encoded_payload() : payload);
+        }
+        if (!ok) {
+            return create_error_response(operation, request_id, code);
+        }
+        if (payload_field.empty()) {
+            return create_response("success", operation, request_id, data_json);
+        }
+        string rest = data_json.size() > 2 ? "," + data_json.substr(1) : "}";
+        if (!payload_base64) {
+            return create_response("success", operation, request_id,
+                                   "{\"" + payload_field + "\":\"" + json_escape(payload) + "\"" + rest);
+        }
+        // Encoded straight into the response instead of through a temporary
+        string out = create_response("success", operation, request_id, "{\"" + payload_field + "\":\"");
+        out.pop_back();
+        size_t at = out.size();
+        out.reserve(at + base64_encoded_size(payload.size()) + rest.size() + 2);
+        out.resize(at + base64_encoded_size(payload.size()));
+        base64_encode(payload.data(), payload.size(), &out[at]);
+        return out + "\"" + rest + "}";
+    }
+    
+    string encoded_payload() const {
+        string out(base64_encoded_size(payload.size()), '\0');
+        base64_encode(payload.data(), payload.size(), &out[0]);
+        return out;
+    }
+};
+
+string handle_init(const RequestParams& params) {
+    string config_path = params.get("config_path");
+    string omni_path = params.get("omni_path");
     
     if (config_path.empty()) config_path = "omnifs.conf";
     if (omni_path.empty()) omni_path = "omnifs.dat";
@@ -100,9 +624,9 @@ string handle_init(const string& params) {
     return "{\"initialized\":false}";
 }
 
-string handle_login(const string& params, string& session_id) {
-    uint32_t user_index = get_json_int(params, "user_index");
-    string password = get_json_value(params, "password");
+string handle_login(const RequestParams& params, string& session_id) {
+    uint32_t user_index = params.get_int("user_index");
+    string password = params.get("password");
     
     void* session = nullptr;
     int result = user_login(&session, fs_instance, user_index, password.c_str());
@@ -134,10 +658,10 @@ string handle_logout(const string& session_id) {
     return "{\"logged_out\":true}";
 }
 
-string handle_user_create(void* session, const string& params) {
-    string username = get_json_value(params, "username");
-    string password = get_json_value(params, "password");
-    int role_int = get_json_int(params, "role");
+string handle_user_create(void* session, const RequestParams& params) {
+    string username = params.get("username");
+    string password = params.get("password");
+    int role_int = params.get_int("role");
     UserRole role = static_cast<UserRole>(role_int);
     
     uint32_t new_index;
@@ -149,8 +673,8 @@ string handle_user_create(void* session, const string& params) {
     return "{}";
 }
 
-string handle_user_delete(void* session, const string& params) {
-    uint32_t user_index = get_json_int(params, "user_index");
+string handle_user_delete(void* session, const RequestParams& params) {
+    uint32_t user_index = params.get_int("user_index");
     int result = user_delete(session, user_index);
     return "{\"deleted\":" + string(result == static_cast<int>(OFSErrorCodes::SUCCESS) ? "true" : "false") + "}";
 }
@@ -176,52 +700,160 @@ string handle_user_list(void* session) {
     return json;
 }
 
-string handle_file_create(void* session, const string& params) {
-    string path = get_json_value(params, "path");
-    string data = get_json_value(params, "data");
-    int result = file_create(session, path.c_str(), data.c_str(), data.length());
+string handle_file_create(void* session, const RequestParams& params) {
+    string path = params.get("path");
+    string data;
+    if (!get_content(params, data)) return "{}";
+    int result = file_create(session, path.c_str(), data.data(), data.length());
     return "{\"created\":" + string(result == static_cast<int>(OFSErrorCodes::SUCCESS) ? "true" : "false") + "}";
 }
 
-string handle_file_read(void* session, const string& params) {
-    string path = get_json_value(params, "path");
+string handle_file_edit(void* session, const RequestParams& params) {
+    string path = params.get("path");
+    uint64_t index;
+    string data;
+    if (!params.get_uint64("index", index) || !get_content(params, data)) return "{}";
+    int result = file_edit(session, path.c_str(), data.data(), data.length(), index);
+    return "{\"edited\":" + string(result == static_cast<int>(OFSErrorCodes::SUCCESS) ? "true" : "false") + "}";
+}
+
+string handle_file_append(void* session, const RequestParams& params) {
+    string path = params.get("path");
+    string data;
+    if (!get_content(params, data)) return "{}";
+    int result = file_append(session, path.c_str(), data.data(), data.length());
+    return "{\"appended\":" + string(result == static_cast<int>(OFSErrorCodes::SUCCESS) ? "true" : "false") + "}";
+}
+
+string handle_file_truncate(void* session, const RequestParams& params) {
+    string path = params.get("path");
+    uint64_t length;
+    if (!params.get_uint64("length", length)) return "{}";
+    int result = file_truncate(session, path.c_str(), length);
+    return "{\"truncated\":" + string(result == static_cast<int>(OFSErrorCodes::SUCCESS) ? "true" : "false") + "}";
+}
+
+// Content handlers leave the file's bytes in content; Response places them
+// (escaped into "content" for JSON, as the raw payload for binary)
+task<string> handle_file_read(void* session, const RequestParams& params, string& content) {
+    string path = params.get("path");
+    char* buffer = nullptr;
+    size_t size = 0;
+    int result = co_await file_read_async(session, path, &buffer, &size);
+    
+    if (result != static_cast<int>(OFSErrorCodes::SUCCESS)) {
+        co_return "{\"size\":0}";
+    }
+    
+    if (buffer) content.assign(buffer, size);
+    free_buffer(buffer);
+    string encoding = content_encoding(params) == ENCODING_BASE64 ? ",\"encoding\":\"base64\"" : "";
+    co_return "{\"size\":" + to_string(size) + encoding + "}";
+}
+
+task<string> handle_file_read_by_inode(void* session, const RequestParams& params, string& content) {
+    uint32_t inode, generation;
+    if (!params.get_uint32("inode", inode) || !params.get_uint32("generation", generation)) co_return "{}";
     char* buffer = nullptr;
     size_t size = 0;
-    int result = file_read(session, path.c_str(), &buffer, &size);
+    int result = co_await file_read_by_inode_async(session, inode, generation, &buffer, &size);
     
     if (result != static_cast<int>(OFSErrorCodes::SUCCESS)) {
-        return "{\"content\":\"\",\"size\":0}";
+        co_return "{\"size\":0}";
     }
     
-    string content = buffer ? string(buffer, size) : "";
+    if (buffer) content.assign(buffer, size);
     free_buffer(buffer);
-    return "{\"content\":\"" + json_escape(content) + "\",\"size\":" + to_string(size) + "}";
+    string encoding = content_encoding(params) == ENCODING_BASE64 ? ",\"encoding\":\"base64\"" : "";
+    co_return "{\"size\":" + to_string(size) + encoding + "}";
+}
+
+task<string> handle_file_read_range(void* session, const RequestParams& params, string& content) {
+    string path = params.get("path");
+    uint64_t offset, length;
+    if (!params.get_uint64("offset", offset) || !params.get_uint64("length", length)) co_return "{}";
+    char* buffer = nullptr;
+    size_t size = 0;
+    int result = co_await file_read_range_async(session, path, offset, length, &buffer, &size);
+    
+    if (result != static_cast<int>(OFSErrorCodes::SUCCESS)) {
+        co_return "{\"size\":0}";
+    }
+    
+    if (buffer) content.assign(buffer, size);
+    free_buffer(buffer);
+    string encoding = content_encoding(params) == ENCODING_BASE64 ? ",\"encoding\":\"base64\"" : "";
+    co_return "{\"offset\":" + to_string(offset) + ",\"size\":" + to_string(size) + encoding + "}";
+}
+
+// "" for a malformed handle, "{}" for one that names no live node
+string handle_stat_by_inode(void* session, const RequestParams& params) {
+    uint32_t inode, generation;
+    if (!params.get_uint32("inode", inode) || !params.get_uint32("generation", generation)) return "";
+    FileMetadata meta;
+    int result = stat_by_inode(session, inode, generation, &meta);
+    
+    if (result != static_cast<int>(OFSErrorCodes::SUCCESS)) {
+        return "{}";
+    }
+    
+    return "{\"path\":\"" + json_escape(meta.path) + "\"," +
+           "\"name\":\"" + json_escape(meta.entry.name) + "\"," +
+           "\"type\":" + to_string(meta.entry.type) + "," +
+           "\"size\":" + to_string(meta.entry.size) + "," +
+           "\"permissions\":" + to_string(meta.entry.permissions) + "," +
+           "\"owner\":\"" + string(meta.entry.owner) + "\"," +
+           "\"inode\":" + to_string(meta.entry.inode) + "," +
+           "\"generation\":" + to_string(meta.entry.generation) + "," +
+           "\"created_time\":" + to_string(meta.entry.created_time) + "," +
+           "\"modified_time\":" + to_string(meta.entry.modified_time) + "," +
+           "\"blocks_used\":" + to_string(meta.blocks_used) + "}";
 }
 
-string handle_file_delete(void* session, const string& params) {
-    string path = get_json_value(params, "path");
+string handle_file_delete(void* session, const RequestParams& params) {
+    string path = params.get("path");
     int result = file_delete(session, path.c_str());
     return "{\"deleted\":" + string(result == static_cast<int>(OFSErrorCodes::SUCCESS) ? "true" : "false") + "}";
 }
 
-string handle_file_rename(void* session, const string& params) {
-    string old_path = get_json_value(params, "old_path");
-    string new_path = get_json_value(params, "new_path");
+string handle_file_rename(void* session, const RequestParams& params) {
+    string old_path = params.get("old_path");
+    string new_path = params.get("new_path");
     int result = file_rename(session, old_path.c_str(), new_path.c_str());
     return "{\"renamed\":" + string(result == static_cast<int>(OFSErrorCodes::SUCCESS) ? "true" : "false") + "}";
 }
 
-string handle_dir_create(void* session, const string& params) {
-    string path = get_json_value(params, "path");
+// Takes the same parameters as file_rename: the copy of old_path is new_path
+string handle_file_copy(void* session, const RequestParams& params) {
+    string old_path = params.get("old_path");
+    string new_path = params.get("new_path");
+    int result = file_copy(session, old_path.c_str(), new_path.c_str());
+    return "{\"copied\":" + string(result == static_cast<int>(OFSErrorCodes::SUCCESS) ? "true" : "false") + "}";
+}
+
+string handle_dir_create(void* session, const RequestParams& params) {
+    string path = params.get("path");
     int result = dir_create(session, path.c_str());
     return "{\"created\":" + string(result == static_cast<int>(OFSErrorCodes::SUCCESS) ? "true" : "false") + "}";
 }
 
-string handle_dir_list(void* session, const string& params) {
-    string path = get_json_value(params, "path");
+string handle_dir_list(void* session, const RequestParams& params) {
+    string path = params.get("path");
+    string start_after = params.get("start_after");
+    string prefix = params.get("prefix");
+    string type = params.get("type");
+    uint32_t limit;
+    if (!params.get_uint32("limit", limit) || limit > INT_MAX) return "{}";
+    
+    int type_filter = -1;
+    if (type == "file") type_filter = static_cast<int>(EntryType::FILE);
+    else if (type == "directory") type_filter = static_cast<int>(EntryType::DIRECTORY);
+    
     FileEntry* entries = nullptr;
     int count = 0;
-    int result = dir_list(session, path.c_str(), &entries, &count);
+    bool has_more = false;
+    int result = dir_list_page(session, path.c_str(), start_after.c_str(), prefix.c_str(),
+                               type_filter, static_cast<int>(limit), &entries, &count, &has_more);
     
     if (result != static_cast<int>(OFSErrorCodes::SUCCESS)) {
         return "{\"entries\":[]}";
@@ -230,22 +862,34 @@ string handle_dir_list(void* session, const string& params) {
     string json = "{\"entries\":[";
     for (int i = 0; i < count; i++) {
         if (i > 0) json += ",";
-        json += "{\"name\":\"" + string(entries[i].name) + "\"," +
+        json += "{\"name\":\"" + json_escape(entries[i].name) + "\"," +
                 "\"type\":" + to_string(entries[i].type) + "," +
                 "\"size\":" + to_string(entries[i].size) + "," +
-                "\"owner\":\"" + string(entries[i].owner) + "\"}";
+                "\"owner\":\"" + string(entries[i].owner) + "\"," +
+                "\"inode\":" + to_string(entries[i].inode) + "," +
+                "\"generation\":" + to_string(entries[i].generation) + "}";
     }
-    json += "]}";
+    json += "],\"has_more\":" + string(has_more ? "true" : "false");
+    if (has_more && count > 0) {
+        json += ",\"next_cursor\":\"" + json_escape(entries[count - 1].name) + "\"";
+    }
+    json += "}";
     free_buffer(entries);
     return json;
 }
 
-string handle_dir_delete(void* session, const string& params) {
-    string path = get_json_value(params, "path");
+string handle_dir_delete(void* session, const RequestParams& params) {
+    string path = params.get("path");
     int result = dir_delete(session, path.c_str());
     return "{\"deleted\":" + string(result == static_cast<int>(OFSErrorCodes::SUCCESS) ? "true" : "false") + "}";
 }
 
+string handle_dir_delete_recursive(void* session, const RequestParams& params) {
+    string path = params.get("path");
+    int result = dir_delete_recursive(session, path.c_str());
+    return "{\"deleted\":" + string(result == static_cast<int>(OFSErrorCodes::SUCCESS) ? "true" : "false") + "}";
+}
+
 string handle_get_stats(void* session) {
     FSStats stats;
     int result = get_stats(session, &stats);
@@ -260,30 +904,198 @@ string handle_get_stats(void* session) {
            ",\"total_files\":" + to_string(stats.total_files) +
            ",\"total_directories\":" + to_string(stats.total_directories) +
            ",\"total_users\":" + to_string(stats.total_users) +
-           ",\"active_sessions\":" + to_string(stats.active_sessions) + "}";
+           ",\"active_sessions\":" + to_string(stats.active_sessions) +
+           ",\"dedup_ratio\":" + to_string(stats.dedup_ratio) +
+           ",\"dedup_index_entries\":" + to_string(stats.dedup_index_entries) +
+           ",\"dedup_index_bytes\":" + to_string(stats.dedup_index_bytes) +
+           ",\"lifetime_compression_ratio\":" + to_string(stats.compression_ratio) +
+           ",\"compress_mb_per_sec\":" + to_string(stats.compress_mb_per_sec) +
+           ",\"decompress_mb_per_sec\":" + to_string(stats.decompress_mb_per_sec) + "}";
 }
 
-string process_request(const string& request) {
-    string operation = get_json_value(request, "operation");
-    string session_id = get_json_value(request, "session_id");
-    string request_id = get_json_value(request, "request_id");
+string handle_server_stats() {
+    string class_json;
+    for (int c = 0; c < CLASS_COUNT; c++) {
+        LatencyHistogram& h = server_stats.class_latency[c];
+        if (c > 0) class_json += ",";
+        class_json += "{\"class\":\"" + string(class_names[c]) + "\",\"weight\":" + to_string(class_weights[c]) +
+                      ",\"count\":" + to_string(h.total.load()) +
+                      ",\"p50_us\":" + to_string(h.percentile(0.50)) +
+                      ",\"p99_us\":" + to_string(h.percentile(0.99)) + "}";
+    }
     
-    size_t params_start = request.find("\"parameters\"");
-    string params = "";
-    if (params_start != string::npos) {
-        size_t brace_start = request.find("{", params_start);
-        if (brace_start != string::npos) {
-            int brace_count = 1;
-            size_t pos = brace_start + 1;
-            while (pos < request.length() && brace_count > 0) {
-                if (request[pos] == '{') brace_count++;
-                else if (request[pos] == '}') brace_count--;
-                pos++;
-            }
-            params = request.substr(brace_start, pos - brace_start);
+    uint64_t completed = server_stats.completed.load();
+    uint64_t divisor = completed > 0 ? completed : 1;
+    return "{\"completed\":" + to_string(completed) +
+           ",\"expired\":" + to_string(server_stats.expired.load()) +
+           ",\"rejected\":" + to_string(server_stats.rejected.load()) +
+           ",\"queued\":" + to_string(request_scheduler->get_size()) +
+           ",\"in_flight\":" + to_string(connections_in_flight.load()) +
+           ",\"avg_queue_wait_us\":" + to_string(server_stats.queue_wait_us.load() / divisor) +
+           ",\"max_queue_wait_us\":" + to_string(server_stats.max_queue_wait_us.load()) +
+           ",\"avg_exec_us\":" + to_string(server_stats.exec_us.load() / divisor) +
+           ",\"max_exec_us\":" + to_string(server_stats.max_exec_us.load()) +
+           ",\"classes\":[" + class_json + "]}";
+}
+
+// "compression" is "on", "off" or "inherit"
+string handle_dir_set_compression(void* session, const RequestParams& params) {
+    string path = params.get("path");
+    string value = params.get("compression");
+    CompressionPolicy policy;
+    if (value == "on") policy = CompressionPolicy::ON;
+    else if (value == "off") policy = CompressionPolicy::OFF;
+    else if (value == "inherit") policy = CompressionPolicy::INHERIT;
+    else return "{}";
+    int result = dir_set_compression(session, path.c_str(), policy);
+    return "{\"updated\":" + string(result == static_cast<int>(OFSErrorCodes::SUCCESS) ? "true" : "false") + "}";
+}
+
+string handle_dir_usage(void* session, const RequestParams& params) {
+    string path = params.get("path");
+    DirUsage usage;
+    int result = dir_usage(session, path.c_str(), &usage);
+    
+    if (result != static_cast<int>(OFSErrorCodes::SUCCESS)) {
+        return "{}";
+    }
+    
+    return "{\"path\":\"" + json_escape(path) + "\"" +
+           ",\"total_bytes\":" + to_string(usage.total_bytes) +
+           ",\"total_blocks\":" + to_string(usage.total_blocks) +
+           ",\"total_files\":" + to_string(usage.total_files) +
+           ",\"total_directories\":" + to_string(usage.total_directories) + "}";
+}
+
+string handle_get_user_usage(void* session, const RequestParams& params) {
+    string username = params.get("username");
+    if (username.empty()) {
+        SessionInfo info;
+        get_session_info(session, &info);
+        username = info.user.username;
+    }
+    
+    uint64_t bytes = 0;
+    uint32_t files = 0;
+    int result = get_user_usage(session, username.c_str(), &bytes, &files);
+    
+    if (result != static_cast<int>(OFSErrorCodes::SUCCESS)) {
+        return "{}";
+    }
+    
+    return "{\"username\":\"" + username + "\",\"used_space\":" + to_string(bytes) +
+           ",\"total_files\":" + to_string(files) + "}";
+}
+
+// Handlers that touch file content are coroutines and may suspend; the
+// rest run straight through
+task<Response> execute_request(const Request& request);
+
+#define BATCH_MAX_OPERATIONS 4096
+
+// Sub-operations of a batch, in order: JSON carries them as the "operations"
+// array of request objects, binary as complete request frames back to back
+// in the "operations" field. They run under the batch's session; their own
+// session ids are ignored. False if any of them is malformed.
+bool parse_batch(const Request& batch, vector<Request>& operations) {
+    if (!batch.binary) {
+        vector<string> objects = get_json_objects(batch.params.json, "operations");
+        for (size_t i = 0; i < objects.size(); i++) {
+            Request sub;
+            parse_json_request(objects[i], sub);
+            if (sub.request_id.empty()) sub.request_id = to_string(i);
+            operations.push_back(move(sub));
+        }
+    } else {
+        const string& frames = batch.params.get("operations");
+        size_t pos = 0;
+        while (pos < frames.size()) {
+            BinaryRequestHeader header;
+            if (frames.size() - pos < sizeof(header)) return false;
+            memcpy(&header, frames.data() + pos, sizeof(header));
+            size_t length = sizeof(header) + header.body_length;
+            if (length > frames.size() - pos) return false;
+            Request sub;
+            if (!parse_binary_request(frames.substr(pos, length), sub)) return false;
+            operations.push_back(move(sub));
+            pos += length;
+        }
+    }
+    for (auto& sub : operations) sub.session_id = batch.session_id;
+    return !operations.empty() && operations.size() <= BATCH_MAX_OPERATIONS;
+}
+
+// Runs a batch's sub-operations back to back in this request's turn and
+// collects their responses: JSON under "results", binary as response frames
+// in the payload (frames). With "atomic" the batch applies all of its
+// mutations or none: it stops at the first step that fails (an error, or a
+// mutation that changed nothing) and rolls back the ones before it through
+// the session's change log. Atomic batches may only hold operations the
+// change log can undo, plus reads.
+task<string> handle_batch(void* session, const Request& request, string& frames) {
+    static const set<string> excluded = {"batch", "init", "login", "logout"};
+    static const set<string> undoable = {
+        "file_create", "file_edit", "file_append", "file_truncate", "file_copy", "file_delete", "file_rename", "move", "dir_create", "dir_delete"
+    };
+    static const set<string> reads = {
+        "file_read", "file_read_by_inode", "file_read_range", "stat_by_inode", "dir_list", "dir_usage",
+        "get_stats", "server_stats", "get_user_usage", "user_list"
+    };
+    
+    vector<Request> operations;
+    if (!parse_batch(request, operations)) co_return "{}";
+    bool atomic = request.params.get_bool("atomic");
+    for (auto& sub : operations) {
+        if (excluded.count(sub.operation)) co_return "{}";
+        if (atomic && !undoable.count(sub.operation) && !reads.count(sub.operation)) co_return "{}";
+    }
+    if (atomic && change_log_begin(session) != static_cast<int>(OFSErrorCodes::SUCCESS)) co_return "{}";
+    
+    string results;
+    size_t done = 0;
+    bool failed = false;
+    for (auto& sub : operations) {
+        size_t changes = change_log_size(session);
+        Response response = co_await execute_request(sub);
+        if (request.binary) frames += response.serialize();
+        else results += (done > 0 ? "," : "") + response.serialize();
+        done++;
+        
+        if (atomic && (response.code != static_cast<int>(OFSErrorCodes::SUCCESS) ||
+                       (undoable.count(sub.operation) && change_log_size(session) == changes))) {
+            failed = true;
+            break;
         }
     }
     
+    string data = request.binary ? "{\"count\":" + to_string(done) : "{\"results\":[" + results + "]";
+    if (atomic && failed) {
+        bool rolled_back = change_log_rollback(session) == static_cast<int>(OFSErrorCodes::SUCCESS);
+        data += ",\"committed\":false,\"rolled_back\":" + string(rolled_back ? "true" : "false");
+    } else if (atomic) {
+        change_log_commit(session);
+        data += ",\"committed\":true";
+    }
+    co_return data + "}";
+}
+
+task<Response> process_request(string raw) {
+    Request request;
+    bool parsed = is_binary_request(raw) ? parse_binary_request(raw, request) : parse_json_request(raw, request);
+    if (!parsed) {
+        co_return Response::error(peek_request(raw), static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION));
+    }
+    co_return co_await execute_request(request);
+}
+
+task<Response> execute_request(const Request& request) {
+    const string& operation = request.operation;
+    const string& session_id = request.session_id;
+    const RequestParams& params = request.params;
+    if (content_encoding(params) == ENCODING_INVALID) {
+        co_return Response::error(request, static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION));
+    }
+    
     void* session = nullptr;
     if (!session_id.empty()) {
         pthread_mutex_lock(&sessions_mutex);
@@ -295,6 +1107,9 @@ string process_request(const string& request) {
     
     int result = 0;
     string data_json;
+    string content;
+    bool has_content = false;
+    string batch_frames;
     
     if (operation == "init") {
         data_json = handle_init(params);
@@ -310,7 +1125,7 @@ string process_request(const string& request) {
         result = static_cast<int>(OFSErrorCodes::SUCCESS);
     }
     else if (!session) {
-        return create_error_response(operation, request_id, static_cast<int>(OFSErrorCodes::ERROR_INVALID_SESSION));
+        co_return Response::error(request, static_cast<int>(OFSErrorCodes::ERROR_INVALID_SESSION));
     }
     else if (operation == "user_create") {
         data_json = handle_user_create(session, params);
@@ -326,150 +1141,650 @@ string process_request(const string& request) {
     }
     else if (operation == "file_create") {
         data_json = handle_file_create(session, params);
-        result = static_cast<int>(OFSErrorCodes::SUCCESS);
+        result = data_json == "{}" ? static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION) : static_cast<int>(OFSErrorCodes::SUCCESS);
+    }
+    else if (operation == "file_edit") {
+        data_json = handle_file_edit(session, params);
+        result = data_json == "{}" ? static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION) : static_cast<int>(OFSErrorCodes::SUCCESS);
+    }
+    else if (operation == "file_append") {
+        data_json = handle_file_append(session, params);
+        result = data_json == "{}" ? static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION) : static_cast<int>(OFSErrorCodes::SUCCESS);
+    }
+    else if (operation == "file_truncate") {
+        data_json = handle_file_truncate(session, params);
+        result = data_json == "{}" ? static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION) : static_cast<int>(OFSErrorCodes::SUCCESS);
     }
     else if (operation == "file_read") {
-        data_json = handle_file_read(session, params);
+        data_json = co_await handle_file_read(session, params, content);
+        has_content = true;
         result = static_cast<int>(OFSErrorCodes::SUCCESS);
     }
+    else if (operation == "file_read_by_inode") {
+        data_json = co_await handle_file_read_by_inode(session, params, content);
+        has_content = true;
+        result = data_json == "{}" ? static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION) : static_cast<int>(OFSErrorCodes::SUCCESS);
+    }
+    else if (operation == "file_read_range") {
+        data_json = co_await handle_file_read_range(session, params, content);
+        has_content = true;
+        result = data_json == "{}" ? static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION) : static_cast<int>(OFSErrorCodes::SUCCESS);
+    }
+    else if (operation == "stat_by_inode") {
+        data_json = handle_stat_by_inode(session, params);
+        result = data_json.empty() ? static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION)
+               : data_json == "{}" ? static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND) : static_cast<int>(OFSErrorCodes::SUCCESS);
+    }
     else if (operation == "file_delete") {
         data_json = handle_file_delete(session, params);
         result = static_cast<int>(OFSErrorCodes::SUCCESS);
     }
-    else if (operation == "file_rename") {
+    else if (operation == "file_rename" || operation == "move") {
         data_json = handle_file_rename(session, params);
         result = static_cast<int>(OFSErrorCodes::SUCCESS);
     }
+    else if (operation == "file_copy") {
+        data_json = handle_file_copy(session, params);
+        result = static_cast<int>(OFSErrorCodes::SUCCESS);
+    }
     else if (operation == "dir_create") {
         data_json = handle_dir_create(session, params);
         result = static_cast<int>(OFSErrorCodes::SUCCESS);
     }
     else if (operation == "dir_list") {
         data_json = handle_dir_list(session, params);
-        result = static_cast<int>(OFSErrorCodes::SUCCESS);
+        result = data_json == "{}" ? static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION) : static_cast<int>(OFSErrorCodes::SUCCESS);
     }
     else if (operation == "dir_delete") {
         data_json = handle_dir_delete(session, params);
         result = static_cast<int>(OFSErrorCodes::SUCCESS);
     }
+    else if (operation == "dir_delete_recursive") {
+        data_json = handle_dir_delete_recursive(session, params);
+        result = static_cast<int>(OFSErrorCodes::SUCCESS);
+    }
+    else if (operation == "dir_set_compression") {
+        data_json = handle_dir_set_compression(session, params);
+        result = data_json == "{}" ? static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION) : static_cast<int>(OFSErrorCodes::SUCCESS);
+    }
+    else if (operation == "dir_usage") {
+        data_json = handle_dir_usage(session, params);
+        result = data_json == "{}" ? static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND) : static_cast<int>(OFSErrorCodes::SUCCESS);
+    }
     else if (operation == "get_stats") {
         data_json = handle_get_stats(session);
         result = static_cast<int>(OFSErrorCodes::SUCCESS);
     }
+    else if (operation == "server_stats") {
+        data_json = handle_server_stats();
+        result = static_cast<int>(OFSErrorCodes::SUCCESS);
+    }
+    else if (operation == "get_user_usage") {
+        data_json = handle_get_user_usage(session, params);
+        result = data_json == "{}" ? static_cast<int>(OFSErrorCodes::ERROR_PERMISSION_DENIED) : static_cast<int>(OFSErrorCodes::SUCCESS);
+    }
+    else if (operation == "batch") {
+        data_json = co_await handle_batch(session, request, batch_frames);
+        result = data_json == "{}" ? static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION) : static_cast<int>(OFSErrorCodes::SUCCESS);
+    }
     else {
-        return create_error_response(operation, request_id, static_cast<int>(OFSErrorCodes::ERROR_NOT_IMPLEMENTED));
+        co_return Response::error(request, static_cast<int>(OFSErrorCodes::ERROR_NOT_IMPLEMENTED));
     }
     
-    if (result == static_cast<int>(OFSErrorCodes::SUCCESS)) {
-        return create_response("success", operation, request_id, data_json);
+    if (result != static_cast<int>(OFSErrorCodes::SUCCESS)) {
+        co_return Response::error(request, result);
+    }
+    Response response = Response::success(request, data_json);
+    if (has_content) {
+        response.payload = move(content);
+        response.payload_field = "content";
+        response.payload_base64 = content_encoding(params) == ENCODING_BASE64;
+    }
+    response.payload += batch_frames;
+    co_return response;
+}
+
+string reject_request(const string& request, OFSErrorCodes code) {
+    return Response::error(peek_request(request), static_cast<int>(code)).serialize();
+}
+
+void pin_to_core(int thread_id) {
+    int cores = static_cast<int>(thread::hardware_concurrency());
+    if (cores <= 0) return;
+    
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(thread_id % cores, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+        cerr << "Worker thread " << thread_id << ": could not pin to core " << thread_id % cores << "\n";
+    }
+}
+
+// Writes the whole response and closes the socket. With io_uring that is a
+// SEND linked to a CLOSE; whatever a short send leaves over, and everything
+// under epoll, goes out with non-blocking sends. A client that is slow to
+// drain its socket parks this coroutine, never the worker, and one that
+// stops reading is dropped after SEND_TIMEOUT_SEC.
+task<void> send_response(Reactor& reactor, int client_fd, string response) {
+    size_t sent = 0;
+    if (reactor.has_ring()) {
+        Reactor::SendResult r = co_await reactor.send_and_close(client_fd, response.data(), response.length(),
+                                                                SEND_TIMEOUT_SEC * 1000);
+        if (r.closed) co_return;
+        if (r.sent < 0) {
+            close(client_fd);
+            co_return;
+        }
+        if (r.sent > 0) sent = r.sent;
+    }
+    while (sent < response.length()) {
+        ssize_t n = send(client_fd, response.data() + sent, response.length() - sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n > 0) {
+            sent += n;
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) &&
+            co_await reactor.writable(client_fd, SEND_TIMEOUT_SEC * 1000) == 0) continue;
+        break;
     }
-    return create_error_response(operation, request_id, result);
+    close(client_fd);
 }
 
+// Tracks where a JSON request ends across reads: once the top-level object's
+// braces balance outside strings. Anything not starting with '{' is complete
+// as is and left for the parser to reject.
+struct JsonFrameScanner {
+    size_t pos = 0;
+    int depth = 0;
+    bool started = false;
+    bool in_string = false;
+    bool escape = false;
+    
+    bool complete(const string& data) {
+        for (; pos < data.size(); pos++) {
+            char c = data[pos];
+            if (!started) {
+                if (isspace(static_cast<unsigned char>(c))) continue;
+                if (c != '{') return true;
+                started = true;
+            }
+            if (in_string) {
+                if (escape) escape = false;
+                else if (c == '\\') escape = true;
+                else if (c == '"') in_string = false;
+            }
+            else if (c == '"') in_string = true;
+            else if (c == '{') depth++;
+            else if (c == '}' && --depth == 0) return true;
+        }
+        return false;
+    }
+};
+
+// Listeners hand over whatever the first read returned; a request larger
+// than that (a binary frame, or JSON carrying file content) is received
+// here, without holding up the worker. False if the client went away, sent
+// nothing for RECV_IDLE_TIMEOUT_SEC or the request is over REQUEST_FRAME_MAX;
+// a JSON request cut short by the client closing its end is still handed to
+// the parser, as it was before.
+task<bool> receive_frame(Reactor& reactor, int client_fd, string& data) {
+    bool binary = is_binary_request(data);
+    JsonFrameScanner json;
+    for (;;) {
+        size_t length = binary ? binary_frame_length(data) : 0;
+        if (binary) {
+            if (length > REQUEST_FRAME_MAX) co_return false;
+            if (length > 0 && data.size() >= length) co_return true;
+        } else {
+            if (json.complete(data)) co_return true;
+            if (data.size() > REQUEST_FRAME_MAX) co_return false;
+        }
+        
+        size_t have = data.size();
+        data.resize(length > 0 ? length : have + max(have, static_cast<size_t>(REQUEST_BUFFER_SIZE)));
+        ssize_t n = recv(client_fd, &data[have], data.size() - have, MSG_DONTWAIT);
+        data.resize(have + (n > 0 ? n : 0));
+        if (n > 0) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) &&
+            co_await reactor.readable(client_fd, RECV_IDLE_TIMEOUT_SEC * 1000) == 0) continue;
+        co_return !binary && n == 0;
+    }
+}
+
+// One turn from dequeue to closed socket, on the worker's reactor. The
+// session's next request is only released once this response has gone out.
+detached serve_turn(Reactor& reactor, SessionScheduler<ClientRequest>::Turn turn) {
+    reactor.started();
+    auto started = chrono::steady_clock::now();
+    uint64_t waited = chrono::duration_cast<chrono::microseconds>(started - turn.item.arrived).count();
+    
+    if (!co_await receive_frame(reactor, turn.item.client_fd, turn.item.request_data)) {
+        close(turn.item.client_fd);
+    } else {
+        string response;
+        // Past its deadline the client has likely given up; answer fast
+        // instead of spending a worker on it
+        if (server_config.queue_timeout > 0 && waited > static_cast<uint64_t>(server_config.queue_timeout) * 1000000) {
+            response = reject_request(turn.item.request_data, OFSErrorCodes::ERROR_TIMEOUT);
+            server_stats.expired++;
+        } else {
+            Response result = co_await process_request(move(turn.item.request_data));
+            uint64_t ran = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - started).count();
+            server_stats.completed++;
+            server_stats.queue_wait_us += waited;
+            server_stats.exec_us += ran;
+            record_max(server_stats.max_queue_wait_us, waited);
+            record_max(server_stats.max_exec_us, ran);
+            server_stats.class_latency[turn.cls].record(waited + ran);
+            response = result.serialize();
+        }
+        co_await send_response(reactor, turn.item.client_fd, move(response));
+    }
+    
+    connections_in_flight--;
+    request_scheduler->finish(turn.lane);
+    reactor.finished();
+}
+
+// Every request runs as a coroutine on this worker's reactor. The worker
+// only parks in take() when none of its requests are in flight; otherwise it
+// picks up new turns (up to WORKER_MAX_IN_FLIGHT) between reactor rounds, so
+// a cold read or a slow client holds up one request, not the worker.
 void* worker_thread(void* arg) {
     int thread_id = *((int*)arg);
+    if (pin_workers) pin_to_core(thread_id);
     cout << "Worker thread " << thread_id << " started\n";
     
-    while (server_running) {
-        ClientRequest req = request_queue->dequeue();
-        
-        if (req.client_fd == -1) break;
+    Reactor reactor(use_io_uring, REACTOR_WAIT_US);
+    Reactor::Scope scope(&reactor);
+    
+    while (true) {
+        vector<SessionScheduler<ClientRequest>::Turn> batch;
+        if (reactor.get_active() == 0) {
+            batch = request_scheduler->take(thread_id, WORKER_BATCH_SIZE);
+            if (batch.empty()) break;
+        } else if (reactor.get_active() < WORKER_MAX_IN_FLIGHT) {
+            size_t room = WORKER_MAX_IN_FLIGHT - reactor.get_active();
+            batch = request_scheduler->try_take(thread_id, min<size_t>(room, WORKER_BATCH_SIZE));
+        }
         
-        string response = process_request(req.request_data);
-        send(req.client_fd, response.c_str(), response.length(), 0);
-        close(req.client_fd);
+        for (auto& turn : batch) {
+            serve_turn(reactor, move(turn));
+        }
+        // Only wait for completions when there was nothing new to start
+        if (reactor.get_active() > 0) reactor.run_once(batch.empty());
     }
     
     cout << "Worker thread " << thread_id << " stopped\n";
     return nullptr;
 }
 
-int main(int argc, char* argv[]) {
-    int port = 8080;
-    int num_workers = 4;
-    int queue_size = 100;
-    
-    if (argc > 1) port = atoi(argv[1]);
-    if (argc > 2) num_workers = atoi(argv[2]);
-    if (argc > 3) queue_size = atoi(argv[3]);
-    
-    request_queue = new BoundedBlockingQueue<ClientRequest>(queue_size);
-    
-    pthread_t* workers = new pthread_t[num_workers];
-    int* worker_ids = new int[num_workers];
-    
-    for (int i = 0; i < num_workers; i++) {
-        worker_ids[i] = i;
-        pthread_create(&workers[i], nullptr, worker_thread, &worker_ids[i]);
+// Shed at the door rather than let the backlog (and everyone's latency) grow
+// without bound; otherwise classify and hand over to the scheduler
+void admit_request(int client_fd, string data) {
+    bool over_connections = server_config.max_connections > 0 &&
+                            connections_in_flight.load() >= server_config.max_connections;
+    if (over_connections || request_scheduler->get_size() >= queue_high_water) {
+        string response = reject_request(data, OFSErrorCodes::ERROR_SERVER_BUSY);
+        send(client_fd, response.c_str(), response.length(), 0);
+        close(client_fd);
+        server_stats.rejected++;
+        return;
     }
     
-    int server_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_fd < 0) {
-        cerr << "Socket creation failed\n";
-        return 1;
-    }
+    // A binary frame whose header and session id did not fit in the first
+    // read runs in a lane of its own
+    connections_in_flight++;
+    Request request = peek_request(data);
+    size_t size = request.binary ? max(binary_frame_length(data), data.size()) : data.size();
+    int cls = classify_request(request.operation, size);
+    request_scheduler->submit(request.session_id, ClientRequest(client_fd, move(data)), cls);
+}
+
+// Each listener owns an SO_REUSEPORT socket, so the kernel spreads incoming
+// connections across listeners; the epoll loop means a client that connects
+// and is slow to send its request no longer holds up everyone behind it
+int open_listen_socket(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd < 0) return -1;
     
     int opt = 1;
-    setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt));
     
     sockaddr_in address;
     address.sin_family = AF_INET;
     address.sin_addr.s_addr = INADDR_ANY;
     address.sin_port = htons(port);
     
-    if (bind(server_fd, (sockaddr*)&address, sizeof(address)) < 0) {
-        cerr << "Bind failed\n";
-        return 1;
+    if (bind(fd, (sockaddr*)&address, sizeof(address)) < 0 || listen(fd, LISTEN_BACKLOG) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+struct ListenerArgs {
+    int id;
+    int listen_fd;
+};
+
+// For a connection the listener will not wait on (over max_connections or
+// its own bound on held connections)
+void turn_away(int fd) {
+    string response = reject_request("", OFSErrorCodes::ERROR_SERVER_BUSY);
+    send(fd, response.c_str(), response.length(), MSG_DONTWAIT | MSG_NOSIGNAL);
+    close(fd);
+    server_stats.rejected++;
+}
+
+// Connections accepted but silent so far count towards max_connections and
+// LISTENER_HELD_MAX, and are dropped after RECV_IDLE_TIMEOUT_SEC by a sweep
+// on each wakeup. Out of descriptors, accept fails while the listen socket
+// stays readable, so it is left out of the epoll set until the next sweep
+// instead of waking the loop over and over.
+void* listener_thread(void* arg) {
+    ListenerArgs* args = static_cast<ListenerArgs*>(arg);
+    int listen_fd = args->listen_fd;
+    
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        cerr << "Listener " << args->id << ": epoll_create1 failed\n";
+        return nullptr;
+    }
+    
+    epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = listen_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev);
+    
+    epoll_event events[LISTENER_MAX_EVENTS];
+    char buffer[REQUEST_BUFFER_SIZE];
+    map<int, chrono::steady_clock::time_point> held;  // accepted fd -> when
+    bool accepting = true;
+    auto last_sweep = chrono::steady_clock::now();
+    
+    while (server_running) {
+        int n = epoll_wait(epoll_fd, events, LISTENER_MAX_EVENTS, 500);
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            
+            if (fd == listen_fd) {
+                // read() below only runs once epoll says there is data.
+                // Responses go out from the worker's reactor as non-blocking
+                // sends that wait for writability (see send_response).
+                for (;;) {
+                    int client_fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+                    if (client_fd < 0) {
+                        if (errno == EMFILE || errno == ENFILE) {
+                            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, listen_fd, nullptr);
+                            accepting = false;
+                        }
+                        break;
+                    }
+                    bool over_connections = server_config.max_connections > 0 &&
+                        connections_in_flight.load() + held.size() >= static_cast<size_t>(server_config.max_connections);
+                    if (over_connections || held.size() >= LISTENER_HELD_MAX) {
+                        turn_away(client_fd);
+                        continue;
+                    }
+                    epoll_event cev;
+                    cev.events = EPOLLIN | EPOLLRDHUP;
+                    cev.data.fd = client_fd;
+                    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_fd, &cev) < 0) close(client_fd);
+                    else held[client_fd] = chrono::steady_clock::now();
+                }
+                continue;
+            }
+            
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+            held.erase(fd);
+            int bytes_read = read(fd, buffer, sizeof(buffer) - 1);
+            if (bytes_read > 0) {
+                admit_request(fd, string(buffer, bytes_read));
+            } else {
+                close(fd);
+            }
+        }
+        
+        auto now = chrono::steady_clock::now();
+        if (now - last_sweep < chrono::milliseconds(500)) continue;
+        last_sweep = now;
+        for (auto it = held.begin(); it != held.end();) {
+            if (now - it->second <= chrono::seconds(RECV_IDLE_TIMEOUT_SEC)) {
+                ++it;
+                continue;
+            }
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, it->first, nullptr);
+            close(it->first);
+            it = held.erase(it);
+        }
+        if (!accepting) {
+            ev.events = EPOLLIN;
+            ev.data.fd = listen_fd;
+            accepting = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev) == 0;
+        }
+    }
+    
+    for (auto& entry : held) close(entry.first);
+    close(epoll_fd);
+    return nullptr;
+}
+
+enum UringEvent : uint64_t { URING_ACCEPT = 1, URING_RECV = 2, URING_TICK = 3, URING_RECV_TIMEOUT = 4 };
+
+// io_uring variant of listener_thread: accepts on the listen socket as
+// registered file 0 and reads each request straight into one of a fixed set
+// of registered buffers; connections beyond the free buffers wait their turn.
+// Every recv carries a linked timeout, so a client that connects and stays
+// silent is dropped after RECV_IDLE_TIMEOUT_SEC instead of pinning its slot.
+// The wait for a slot is bounded too: past URING_WAITING_MAX (or
+// max_connections, counting held connections) and after queue_timeout,
+// connections are turned away with ERROR_SERVER_BUSY.
+// A 500ms timeout SQE wakes the loop to notice shutdown, like epoll_wait's.
+void* listener_thread_uring(void* arg) {
+    ListenerArgs* args = static_cast<ListenerArgs*>(arg);
+    IoUring ring(256);
+    vector<char> pool(URING_RECV_SLOTS * REQUEST_BUFFER_SIZE);
+    vector<iovec> iov(URING_RECV_SLOTS);
+    for (int i = 0; i < URING_RECV_SLOTS; i++) {
+        iov[i].iov_base = &pool[i * REQUEST_BUFFER_SIZE];
+        iov[i].iov_len = REQUEST_BUFFER_SIZE;
+    }
+    if (!ring.ok() || !ring.use_file(args->listen_fd, 0) || !ring.register_buffers(iov.data(), URING_RECV_SLOTS)) {
+        cerr << "Listener " << args->id << ": io_uring setup failed, using epoll\n";
+        return listener_thread(arg);
+    }
+    
+    __kernel_timespec tick;
+    tick.tv_sec = 0;
+    tick.tv_nsec = 500 * 1000 * 1000;
+    __kernel_timespec idle;
+    idle.tv_sec = RECV_IDLE_TIMEOUT_SEC;
+    idle.tv_nsec = 0;
+    
+    auto post_accept = [&]() {
+        io_uring_sqe* sqe = ring.get_sqe();
+        IoUring::prep_rw(sqe, IORING_OP_ACCEPT, 0, nullptr, 0, 0, URING_ACCEPT << 56);
+        sqe->accept_flags = SOCK_CLOEXEC;
+        sqe->flags |= IOSQE_FIXED_FILE;
+    };
+    auto post_recv = [&](int fd, int slot) {
+        io_uring_sqe* sqe = ring.get_sqe();
+        IoUring::prep_rw(sqe, IORING_OP_READ_FIXED, fd, iov[slot].iov_base, REQUEST_BUFFER_SIZE - 1, 0,
+                         URING_RECV << 56 | static_cast<uint64_t>(slot) << 32 | static_cast<uint32_t>(fd));
+        sqe->buf_index = slot;
+        sqe->flags |= IOSQE_IO_LINK;
+        // Cancels the read (it completes with -ECANCELED) if nothing arrives in time
+        io_uring_sqe* timeout = ring.get_sqe();
+        IoUring::prep_rw(timeout, IORING_OP_LINK_TIMEOUT, -1, &idle, 1, 0, URING_RECV_TIMEOUT << 56);
+    };
+    auto post_tick = [&]() {
+        io_uring_sqe* sqe = ring.get_sqe();
+        IoUring::prep_rw(sqe, IORING_OP_TIMEOUT, -1, &tick, 1, 0, URING_TICK << 56);
+    };
+    
+    vector<int> free_slots;
+    for (int i = URING_RECV_SLOTS - 1; i >= 0; i--) free_slots.push_back(i);
+    deque<pair<int, chrono::steady_clock::time_point>> waiting;
+    
+    post_accept();
+    post_tick();
+    
+    while (server_running) {
+        ring.submit(1);
+        io_uring_cqe cqe;
+        while (ring.peek(cqe)) {
+            uint64_t kind = cqe.user_data >> 56;
+            if (kind == URING_ACCEPT) {
+                if (cqe.res >= 0) {
+                    size_t held = URING_RECV_SLOTS - free_slots.size() + waiting.size();
+                    bool over_connections = server_config.max_connections > 0 &&
+                        connections_in_flight.load() + held >= static_cast<size_t>(server_config.max_connections);
+                    if (over_connections || (free_slots.empty() && waiting.size() >= URING_WAITING_MAX)) {
+                        turn_away(cqe.res);
+                    } else if (free_slots.empty()) {
+                        waiting.push_back({cqe.res, chrono::steady_clock::now()});
+                    } else {
+                        post_recv(cqe.res, free_slots.back());
+                        free_slots.pop_back();
+                    }
+                }
+                post_accept();
+            } else if (kind == URING_RECV) {
+                int slot = static_cast<int>((cqe.user_data >> 32) & 0xffffff);
+                int fd = static_cast<int>(cqe.user_data & 0xffffffff);
+                if (cqe.res > 0) {
+                    admit_request(fd, string(static_cast<char*>(iov[slot].iov_base), cqe.res));
+                } else {
+                    close(fd);
+                }
+                if (!waiting.empty()) {
+                    post_recv(waiting.front().first, slot);
+                    waiting.pop_front();
+                } else {
+                    free_slots.push_back(slot);
+                }
+            } else if (kind == URING_TICK) {
+                auto now = chrono::steady_clock::now();
+                while (server_config.queue_timeout > 0 && !waiting.empty() &&
+                       now - waiting.front().second > chrono::seconds(server_config.queue_timeout)) {
+                    turn_away(waiting.front().first);
+                    waiting.pop_front();
+                }
+                post_tick();
+            }
+        }
     }
     
-    if (listen(server_fd, 50) < 0) {
-        cerr << "Listen failed\n";
+    return nullptr;
+}
+
+int main(int argc, char* argv[]) {
+    int num_workers = static_cast<int>(thread::hardware_concurrency());
+    int queue_size = 100;
+    int num_listeners = 1;
+    
+    // Positional: [port] [workers] [queue_size] [listeners]; flags may appear anywhere
+    vector<string> positional;
+    string config_path = "default.uconf";
+    bool config_required = false;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--pin-workers") pin_workers = true;
+        else if (arg.rfind("--config=", 0) == 0) {
+            config_path = arg.substr(9);
+            config_required = true;
+        }
+        else if (arg == "--io-uring") use_io_uring = true;
+        else if (arg == "--dispatch=round-robin") session_affinity = false;
+        else if (arg == "--dispatch=session") session_affinity = true;
+        else positional.push_back(arg);
+    }
+    if (!parse_server_config(server_config, config_path) && config_required) {
+        cerr << "Cannot read config: " << config_path << "\n";
         return 1;
     }
     
+    int port = server_config.port;
+    if (positional.size() > 0) port = atoi(positional[0].c_str());
+    if (positional.size() > 1) num_workers = atoi(positional[1].c_str());
+    if (positional.size() > 2) queue_size = atoi(positional[2].c_str());
+    if (positional.size() > 3) num_listeners = atoi(positional[3].c_str());
+    if (num_workers <= 0) num_workers = 4;
+    if (num_listeners <= 0) num_listeners = 1;
+    
+    queue_high_water = queue_size * QUEUE_HIGH_WATER_PERCENT / 100;
+    if (queue_high_water < 1) queue_high_water = 1;
+    
+    if (use_io_uring && !IoUring::available()) {
+        cerr << "io_uring is not available on this kernel, falling back to epoll\n";
+        use_io_uring = false;
+    }
+    IoUring::enabled = use_io_uring;
+    
+    vector<int> listen_fds;
+    for (int i = 0; i < num_listeners; i++) {
+        int fd = open_listen_socket(port);
+        if (fd < 0) {
+            cerr << "Bind failed\n";
+            return 1;
+        }
+        listen_fds.push_back(fd);
+    }
+    
+    request_scheduler = new SessionScheduler<ClientRequest>(num_workers, queue_size, session_affinity, class_weights);
+    
+    pthread_t* workers = new pthread_t[num_workers];
+    int* worker_ids = new int[num_workers];
+    
+    for (int i = 0; i < num_workers; i++) {
+        worker_ids[i] = i;
+        pthread_create(&workers[i], nullptr, worker_thread, &worker_ids[i]);
+    }
+    
     cout << "========================================\n";
     cout << "OMNIFS Server Configuration:\n";
     cout << "  Port: " << port << "\n";
     cout << "  Worker Threads: " << num_workers << "\n";
+    cout << "  Listener Threads: " << num_listeners << "\n";
     cout << "  Queue Size: " << queue_size << "\n";
+    cout << "  I/O Engine: " << (use_io_uring ? "io_uring" : "epoll") << "\n";
+    cout << "  Max Connections: " << (server_config.max_connections > 0 ? to_string(server_config.max_connections) : "unlimited") << "\n";
+    cout << "  Queue Timeout: " << server_config.queue_timeout << "s\n";
+    cout << "  Dispatch: " << (session_affinity ? "session affinity" : "round-robin") << "\n";
+    cout << "  Pin Workers: " << (pin_workers ? "yes" : "no") << "\n";
     cout << "========================================\n";
     cout << "Server is running... Press Ctrl+C to stop\n\n";
     
-    while (server_running) {
-        sockaddr_in client_addr;
-        socklen_t client_len = sizeof(client_addr);
-        int client_fd = accept(server_fd, (sockaddr*)&client_addr, &client_len);
-        
-        if (client_fd < 0) continue;
-        
-        char buffer[4096] = {0};
-        int bytes_read = read(client_fd, buffer, sizeof(buffer) - 1);
-        
-        if (bytes_read > 0) {
-            buffer[bytes_read] = '\0';
-            ClientRequest req(client_fd, string(buffer));
-            request_queue->enqueue(req);
-        } else {
-            close(client_fd);
-        }
+    vector<pthread_t> listeners(num_listeners);
+    vector<ListenerArgs> listener_args(num_listeners);
+    for (int i = 0; i < num_listeners; i++) {
+        listener_args[i] = ListenerArgs{i, listen_fds[i]};
+        pthread_create(&listeners[i], nullptr, use_io_uring ? listener_thread_uring : listener_thread, &listener_args[i]);
     }
     
-    server_running = false;
-    for (int i = 0; i < num_workers; i++) {
-        request_queue->enqueue(ClientRequest(-1, ""));
+    for (int i = 0; i < num_listeners; i++) {
+        pthread_join(listeners[i], nullptr);
     }
     
+    server_running = false;
+    request_scheduler->stop();
+    
     for (int i = 0; i < num_workers; i++) {
         pthread_join(workers[i], nullptr);
     }
     
     delete[] workers;
     delete[] worker_ids;
-    delete request_queue;
+    cout << "Work steals: " << request_scheduler->get_steal_count() << "\n";
+    cout << "Requests: " << server_stats.completed << " completed, " << server_stats.expired << " expired, "
+         << server_stats.rejected << " rejected\n";
+    delete request_scheduler;
     
     if (fs_instance) fs_shutdown(fs_instance);
-    close(server_fd);
+    for (int fd : listen_fds) close(fd);
     
     cout << "\nServer shutdown complete\n";
     return 0;
-}
\ No newline at end of file
+}